@@ -0,0 +1,66 @@
+#!/bin/sh
+# Runs tsp-compact and tsp-cuts on instances generated by tsp-gen, for
+# each kind of points, size and seed, and writes one CSV line per run:
+#
+#   program,kind,cities,seed,seconds,status,length,bound,nodes,cuts,gap
+#
+# status is ok, timeout (killed after TIME_LIMIT seconds) or error. Both
+# programs build n^2 variables, so sizes of thousands of cities are only
+# practical for the instance tools (tsp-snapshot, spaths-bench).
+#
+# usage: ./bench-tsp.sh [output.csv]
+#
+# settings, from the environment:
+#   SIZES       default "100 200 500 1000"
+#   KINDS       default "uniform clustered grid"
+#   SEEDS       default "1 2 3"
+#   PROGRAMS    default "tsp-compact tsp-cuts"
+#   TIME_LIMIT  seconds per run, default 600
+#   DATA_DIR    generated instances, default bench-data
+
+OUT=${1:-bench-tsp.csv}
+SIZES=${SIZES:-"100 200 500 1000"}
+KINDS=${KINDS:-"uniform clustered grid"}
+SEEDS=${SEEDS:-"1 2 3"}
+PROGRAMS=${PROGRAMS:-"tsp-compact tsp-cuts"}
+TIME_LIMIT=${TIME_LIMIT:-600}
+DATA_DIR=${DATA_DIR:-bench-data}
+
+make tsp-gen $PROGRAMS || exit 1
+mkdir -p "$DATA_DIR" || exit 1
+
+echo "program,kind,cities,seed,seconds,status,length,bound,nodes,cuts,gap" > "$OUT"
+
+for kind in $KINDS; do
+    for n in $SIZES; do
+        for seed in $SEEDS; do
+            inst="$DATA_DIR/$kind$n-s$seed.tsp"
+            [ -f "$inst" ] || ./tsp-gen "$kind" "$n" "$seed" "$inst" || exit 1
+            for prog in $PROGRAMS; do
+                log="$DATA_DIR/$prog-$kind$n-s$seed.log"
+                start=$(date +%s.%N)
+                timeout "$TIME_LIMIT" "./$prog" "$inst" > "$log" 2>&1
+                code=$?
+                end=$(date +%s.%N)
+                case $code in
+                    0) status=ok ;;
+                    124) status=timeout ;;
+                    *) status=error ;;
+                esac
+                # summary lines printed at the end of the solve
+                summary=$(awk '
+                    /^best route found has length/ { length_ = $6; sub(",", "", length_); bound = $NF }
+                    /^search nodes:/ {
+                        for (i = 1; i <= NF; ++i) {
+                            if ($i == "nodes:") { nodes = $(i+1); sub(",", "", nodes) }
+                            if ($i == "cuts:") { cuts = $(i+1); sub(",", "", cuts) }
+                            if ($i == "gap:") { gap = $(i+1); sub("%", "", gap) }
+                        }
+                    }
+                    END { printf "%s,%s,%s,%s,%s", length_, bound, nodes, cuts, gap }' "$log")
+                seconds=$(echo "$start $end" | awk '{ printf "%.3f", $2-$1 }')
+                echo "$prog,$kind,$n,$seed,$seconds,$status,$summary" | tee -a "$OUT"
+            done
+        done
+    done
+done
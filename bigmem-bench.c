@@ -0,0 +1,198 @@
+/********************************************************************************
+ * bigmem-bench
+ *
+ * Measures random reads in a large matrix allocated by bm_alloc with normal
+ * pages, transparent huge pages and explicit huge pages: time per read and
+ * data TLB misses, counted with perf_event_open.
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0
+ *
+ ********************************************************************************/
+
+/**
+ * @file bigmem-bench.c
+ *
+ * Usage: bigmem-bench [megabytes] [reads]
+ *
+ * Defaults: a 1024 MB matrix and 20000000 reads. Reads go to random cells
+ * (i,j), as tspi_dist and the variable maps of the drivers are read. The
+ * TLB miss count needs perf events (kernel.perf_event_paranoid <= 2) and
+ * explicit huge pages a reserved pool (vm.nr_hugepages), otherwise they are
+ * reported as not available.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+#include "bigmem.h"
+
+static double wall_time()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* counter of data TLB read misses of this process, -1 if not available */
+static int open_dtlb_counter()
+{
+#if defined(__linux__) && defined(SYS_perf_event_open)
+    struct perf_event_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+#else
+    return -1;
+#endif
+}
+
+/* kB of huge pages in the mapping that contains p, from /proc/self/smaps */
+static long huge_kb( const void *p )
+{
+    FILE *f = fopen( "/proc/self/smaps", "r" );
+    if ( !f )
+        return -1;
+
+    char line[512];
+    char inside = 0;
+    long result = 0;
+    while ( fgets( line, sizeof(line), f ) )
+    {
+        unsigned long start, end;
+        long kb;
+        if ( sscanf( line, "%lx-%lx ", &start, &end ) == 2 )
+            inside = ((uintptr_t) p >= start && (uintptr_t) p < end);
+        else if ( inside && sscanf( line, "AnonHugePages: %ld kB", &kb ) == 1 )
+            result += kb;
+        else if ( inside && sscanf( line, "Private_Hugetlb: %ld kB", &kb ) == 1 )
+            result += kb;
+    }
+    fclose( f );
+
+    return result;
+}
+
+/* free pages in the explicit huge page pool */
+static long free_huge_pages()
+{
+    FILE *f = fopen( "/proc/meminfo", "r" );
+    if ( !f )
+        return 0;
+
+    char line[256];
+    long result = 0;
+    while ( fgets( line, sizeof(line), f ) )
+        if ( sscanf( line, "HugePages_Free: %ld", &result ) == 1 )
+            break;
+    fclose( f );
+
+    return result;
+}
+
+static uint64_t rngState = 1;
+
+static uint64_t next_rand()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+int main( int argc, char **argv )
+{
+    const size_t megabytes = argc>1 ? (size_t) atol( argv[1] ) : 1024;
+    const long long reads = argc>2 ? atoll( argv[2] ) : 20000000LL;
+    const size_t size = megabytes*1024*1024;
+    size_t side = 1;
+    while ( (side+1)*(side+1)*sizeof(int) <= size )
+        ++side;
+    if ( side < 2 || reads < 1 )
+    {
+        fprintf( stderr, "usage: bigmem-bench [megabytes] [reads]\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    printf( "%zu x %zu int matrix (%.1f MB), %lld random reads\n", side, side,
+            sizeof(int)*side*side/1048576.0, reads );
+
+    const struct
+    {
+        const char *name;
+        int flags;
+    } modes[] = { { "small pages", BM_SMALL_PAGES }, { "thp", BM_THP }, { "hugetlb", BM_HUGETLB } };
+
+    for ( int m=0 ; (m<(int)(sizeof(modes)/sizeof(modes[0]))) ; ++m )
+    {
+        const size_t bytes = sizeof(int)*side*side;
+
+        // without a pool bm_alloc would use transparent huge pages
+        if ( modes[m].flags == BM_HUGETLB && (size_t) free_huge_pages()*2*1024*1024 < bytes )
+        {
+            printf( "%-12s not available (not enough free pages in vm.nr_hugepages)\n", modes[m].name );
+            continue;
+        }
+
+        bm_set_flags( modes[m].flags );
+        int *d = bm_alloc( bytes );
+        for ( size_t i=0 ; (i<side*side) ; ++i )
+            d[i] = (int) (i & 0xFFFF);
+        const long hugeKb = huge_kb( d );
+
+        const int fd = open_dtlb_counter();
+        if ( fd >= 0 )
+        {
+            ioctl( fd, PERF_EVENT_IOC_RESET, 0 );
+            ioctl( fd, PERF_EVENT_IOC_ENABLE, 0 );
+        }
+
+        rngState = 88172645463325252ULL;
+        long long sum = 0;
+        const double start = wall_time();
+        for ( long long r=0 ; (r<reads) ; ++r )
+        {
+            const uint64_t v = next_rand();
+            const size_t i = (size_t) ((v >> 32) % side);
+            const size_t j = (size_t) ((v & 0xFFFFFFFFULL) % side);
+            sum += d[i*side+j];
+        }
+        const double secs = wall_time() - start;
+
+        long long misses = -1;
+        if ( fd >= 0 )
+        {
+            ioctl( fd, PERF_EVENT_IOC_DISABLE, 0 );
+            if ( read( fd, &misses, sizeof(misses) ) != sizeof(misses) )
+                misses = -1;
+            close( fd );
+        }
+
+        printf( "%-12s %8.1f MB on huge pages %8.3f s %8.2f ns/read", modes[m].name,
+                hugeKb >= 0 ? hugeKb/1024.0 : 0.0, secs, secs*1e9/reads );
+        if ( misses >= 0 )
+            printf( "  dTLB misses %12lld (%.3f/read)", misses, ((double) misses)/reads );
+        else
+            printf( "  dTLB misses n/a" );
+        printf( "  [%lld]\n", sum % 1000 );
+
+        bm_free( d, bytes );
+    }
+
+    return EXIT_SUCCESS;
+}
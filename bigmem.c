@@ -0,0 +1,138 @@
+/********************************************************************************
+ * BigMem
+ * Allocation of large matrices backed by huge pages
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0
+ *
+ ********************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "bigmem.h"
+
+// size of huge pages (x86-64 and most aarch64 kernels)
+#ifndef BM_HUGE_PAGE
+#define BM_HUGE_PAGE (2UL*1024*1024)
+#endif
+
+// smaller blocks come from malloc
+#ifndef BM_MIN_BYTES
+#define BM_MIN_BYTES (4UL*1024*1024)
+#endif
+
+#ifndef BM_DEFAULT_FLAGS
+#define BM_DEFAULT_FLAGS BM_THP
+#endif
+
+// mbind policy, from linux/mempolicy.h
+#define BM_MPOL_INTERLEAVE 3
+
+static int bmFlags = BM_DEFAULT_FLAGS;
+
+void bm_set_flags( int flags )
+{
+    bmFlags = flags;
+}
+
+int bm_flags()
+{
+    return bmFlags;
+}
+
+static size_t mapped_size( size_t size )
+{
+    return (size + BM_HUGE_PAGE - 1) / BM_HUGE_PAGE * BM_HUGE_PAGE;
+}
+
+static void no_memory( size_t size )
+{
+    fprintf(stderr, "No more memory available. Trying to allocate %zu bytes.", size);
+    abort();
+}
+
+/* anonymous mapping aligned to a huge page, the
+ * parts of the larger mapping around it are unmapped */
+static char *map_aligned( size_t len )
+{
+    const size_t extra = len + BM_HUGE_PAGE;
+    char *base = mmap( NULL, extra, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+    if ( base == MAP_FAILED )
+        return NULL;
+
+    char *p = (char *) ((((uintptr_t) base) + BM_HUGE_PAGE - 1) / BM_HUGE_PAGE * BM_HUGE_PAGE);
+    if ( p > base )
+        munmap( base, p-base );
+    if ( base+extra > p+len )
+        munmap( p+len, (base+extra) - (p+len) );
+
+    return p;
+}
+
+static void interleave( void *p, size_t len )
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    // all nodes, the kernel only uses the allowed ones
+    unsigned long nodeMask[2] = { ~0UL, ~0UL };
+    syscall( SYS_mbind, p, len, BM_MPOL_INTERLEAVE, nodeMask, sizeof(nodeMask)*8, 0 );
+#else
+    (void) p;
+    (void) len;
+#endif
+}
+
+void *bm_alloc( size_t size )
+{
+    if ( size < BM_MIN_BYTES )
+    {
+        void *result = malloc( size ? size : 1 );
+        if ( !result )
+            no_memory( size );
+        return result;
+    }
+
+    const size_t len = mapped_size( size );
+    char *p = NULL;
+#ifdef MAP_HUGETLB
+    if ( bmFlags & BM_HUGETLB )
+    {
+        p = mmap( NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0 );
+        p = (p == MAP_FAILED) ? NULL : p;
+    }
+#endif
+    const char hugetlb = (p != NULL);
+    if ( !p )
+        p = map_aligned( len );
+    if ( !p )
+        no_memory( size );
+
+    // policies apply to pages touched after them
+    if ( bmFlags & BM_INTERLEAVE )
+        interleave( p, len );
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+    if ( !hugetlb )
+        madvise( p, len, (bmFlags & (BM_THP|BM_HUGETLB)) ? MADV_HUGEPAGE : MADV_NOHUGEPAGE );
+#else
+    (void) hugetlb;
+#endif
+
+    return p;
+}
+
+void bm_free( void *p, size_t size )
+{
+    if ( !p )
+        return;
+
+    if ( size < BM_MIN_BYTES )
+        free( p );
+    else
+        munmap( p, mapped_size( size ) );
+}
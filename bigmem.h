@@ -0,0 +1,55 @@
+/********************************************************************************
+ * BigMem
+ * Allocation of large matrices backed by huge pages
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0
+ *
+ ********************************************************************************/
+
+#ifndef BIGMEM_H
+#define BIGMEM_H
+
+/**
+ * @file bigmem.h
+ *
+ * Allocator for n x n blocks (distance matrices, Floyd-Warshall tables,
+ * variable index maps) that are accessed at random: with 4 KB pages
+ * almost every access misses the TLB, with 2 MB pages the TLB covers
+ * 512 times more memory. Blocks of at least 4 MB (BM_MIN_BYTES) are
+ * anonymous mappings aligned to huge pages, smaller ones come from malloc.
+ * Features missing in the system (explicit huge pages without a
+ * reserved pool, NUMA policies on a single node, other platforms) are
+ * skipped silently, the memory is still allocated.
+ */
+
+#include <stddef.h>
+
+/* flags for bm_set_flags */
+#define BM_SMALL_PAGES 0   /**< normal pages, for comparisons **/
+#define BM_THP         1   /**< transparent huge pages (madvise) **/
+#define BM_HUGETLB     2   /**< explicit huge pages from the pool reserved in
+                                /proc/sys/vm/nr_hugepages, with BM_THP as fallback **/
+#define BM_INTERLEAVE  4   /**< pages interleaved across NUMA nodes **/
+
+/** @brief sets the flags of the next allocations, by default BM_THP
+ * @param flags combination of BM_THP, BM_HUGETLB and BM_INTERLEAVE
+ **/
+void bm_set_flags( int flags );
+
+int bm_flags();
+
+/** @brief allocates size bytes, aborting if there is no memory
+ * @param size bytes
+ * @return memory aligned to huge pages for large blocks, not initialized
+ **/
+void *bm_alloc( size_t size );
+
+/** @brief frees memory of bm_alloc
+ * @param p memory returned by bm_alloc, may be NULL
+ * @param size bytes, as passed to bm_alloc
+ **/
+void bm_free( void *p, size_t size );
+
+#endif
@@ -21,8 +21,18 @@
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#ifdef MINC_STATS
+#include <time.h>
+#endif
 #include "mincut.h"
 
+/* operation counters, only with -DMINC_STATS */
+#ifdef MINC_STATS
+#define MINC_COUNT( minc, counter, n ) ( (minc)->stats.counter += (n) )
+#else
+#define MINC_COUNT( minc, counter, n )
+#endif
+
 /* macros */
 #define INT_RANDOM( n ) \
    ((int) floor( ((double)(n)) * (((double)rand())/(((double)RAND_MAX)+((double)1.0))) ))
@@ -392,6 +402,10 @@ struct _MinCut
     int nCut;
     int *cutU;
     int *cutV;
+
+#ifdef MINC_STATS
+    MinCStats stats;
+#endif
 };
 
 static char *arcName( char *str, int u, int v )
@@ -411,6 +425,9 @@ static int arcPos( const MinCut *minc, int u, int v )
 MinCut *minc_create( int nArcs, const int _tail[], const int _head[], const int _cap[], int s, int t )
 {
     assert( s!=t );
+#ifdef MINC_STATS
+    const clock_t startBuild = clock();
+#endif
 
     int maxN = -1;
     for ( int i=0 ; (i<nArcs) ; ++i )
@@ -575,6 +592,11 @@ MinCut *minc_create( int nArcs, const int _tail[], const int _head[], const int
     for ( int i=0 ; i<nArcs ; ++i )
         arcs[i].original = arcs[i].cap>0;
 
+#ifdef MINC_STATS
+    memset( &minc->stats, 0, sizeof(MinCStats) );
+    minc->stats.buildTime = ((double)(clock()-startBuild)) / CLOCKS_PER_SEC;
+#endif
+
     return minc;
 }
 
@@ -622,6 +644,7 @@ static char bfs( MinCut *minc )
     while ( nQueue>0 )
     {
         int u = queue[--nQueue];
+        MINC_COUNT( minc, arcsScanned, start[u+1]-start[u] );
 
         // exploring neighbors of u
         for ( int p=start[u] ; p<start[u+1] ; ++p )
@@ -651,6 +674,7 @@ static void dfs( MinCut *minc, int s )
     char *ivVisited = minc->ivVisited;
 
     addVisited( minc, s );
+    MINC_COUNT( minc, arcsScanned, start[s+1]-start[s] );
     
     // checking neighbors
     for ( int j=start[s] ; (j<start[s+1]) ; ++j )
@@ -673,6 +697,7 @@ int minc_optimize( MinCut *minc )
     while ( bfs( minc ) )
     {
         int flow = INT_MAX;
+        MINC_COUNT( minc, augmentingPaths, 1 );
        
         for ( int v=t; (v!=s) ; v=parent[v] )
         {
@@ -749,6 +774,17 @@ int minc_n( MinCut *minc )
     return minc->n;
 }
 
+MinCStats minc_stats( const MinCut *minc )
+{
+#ifdef MINC_STATS
+    return minc->stats;
+#else
+    MinCStats stats;
+    memset( &stats, 0, sizeof(MinCStats) );
+    return stats;
+#endif
+}
+
 char minc_in_s(MinCut *minc, int i)
 {
     return minc->ivVisited[minc->newIdx[i]];
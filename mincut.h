@@ -25,6 +25,16 @@
 
 typedef struct _MinCut MinCut;
 
+/** @brief operation counters of a min cut solver, only collected
+ * when mincut.c is compiled with -DMINC_STATS (all zero otherwise)
+ **/
+typedef struct
+{
+    int augmentingPaths;     /**< paths found by minc_optimize **/
+    long long arcsScanned;   /**< arcs visited in searches **/
+    double buildTime;        /**< CPU seconds spent in minc_create **/
+} MinCStats;
+
 /** @brief creates a min cut solver
  * @param nArcs number of arcs
  * @param tail vector with arc sources
@@ -80,6 +90,13 @@ int minc_cut_arc_destination( MinCut *minc, int i );
 char minc_in_s(MinCut *minc, int i);
 
 
+/** @brief operation counters of the solver
+ * @param minc mincut solver object
+ * @return counters, all zero if compiled without MINC_STATS
+ **/
+MinCStats minc_stats( const MinCut *minc );
+
+
 /** @brief frees memory of mincut solver
  **/
 void minc_free( MinCut **_minc );
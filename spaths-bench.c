@@ -0,0 +1,216 @@
+/********************************************************************************
+ * spaths-bench
+ *
+ * Measures the time of shortest path searches from all nodes in complete
+ * graphs, like the ones built by tsp-cuts, or from some nodes of large sparse
+ * graphs, with the different graph layouts of ShortestPathsFinder and with the
+ * heap based and dense searches.
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0
+ *
+ ********************************************************************************/
+
+/**
+ * @file spaths-bench.c
+ *
+ * Usage: spaths-bench instance.tsp
+ *        spaths-bench -n nodes [seed]
+ *        spaths-bench graph.gr [origins]
+ *
+ * The second form generates a complete graph with random points in the plane.
+ * Graphs in the DIMACS format (.gr) are searched from origins nodes (default
+ * 64) spread over the graph.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include "spaths.h"
+#include "tsp-instance.h"
+
+static double wall_time()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void *xmalloc( const size_t size );
+
+/* searches from nOrigins nodes, returns the sum
+ * of distances so that the runs can be compared */
+static long long all_searches( ShortestPathsFinder *spf, int n, int nOrigins, double *secs )
+{
+    long long sum = 0;
+    const double start = wall_time();
+    for ( int o=0 ; (o<nOrigins) ; ++o )
+    {
+        spf_find( spf, (int) (((long long)o)*n/nOrigins) );
+        for ( int j=0 ; (j<n) ; ++j )
+            if ( spf_get_dist( spf, j ) != SP_INFTY_DIST )
+                sum += spf_get_dist( spf, j );
+    }
+    *secs = wall_time() - start;
+
+    return sum;
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc<2 )
+    {
+        fprintf( stderr, "usage: spaths-bench instance.tsp\n       spaths-bench -n nodes [seed]\n       spaths-bench graph.gr [origins]\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    int n = 0;
+    int *start = NULL, *to = NULL, *dist = NULL;
+    int na = 0;
+    ShortestPathsFinder *spf = NULL;
+    const size_t len = strlen( argv[1] );
+    if ( len>3 && strcmp( argv[1]+len-3, ".gr" )==0 )
+    {
+        spf = spf_load_gr( argv[1] );
+        n = spf_nodes( spf );
+        na = spf_arcs( spf );
+    }
+    else if ( strcmp( argv[1], "-n" )==0 )
+    {
+        if ( argc<3 )
+        {
+            fprintf( stderr, "number of nodes missing\n" );
+            exit( EXIT_FAILURE );
+        }
+        n = atoi( argv[2] );
+        srand( argc>3 ? atoi( argv[3] ) : 1 );
+
+        double *x = xmalloc( sizeof(double)*n );
+        double *y = xmalloc( sizeof(double)*n );
+        for ( int i=0 ; (i<n) ; ++i )
+        {
+            x[i] = rand()%10000;
+            y[i] = rand()%10000;
+        }
+
+        start = xmalloc( sizeof(int)*(n+1) );
+        to = xmalloc( sizeof(int)*n*n );
+        dist = xmalloc( sizeof(int)*n*n );
+        start[0] = 0;
+        for ( int i=0 ; (i<n) ; ++i )
+        {
+            for ( int j=0 ; (j<n) ; ++j )
+            {
+                if ( i==j )
+                    continue;
+                to[na] = j;
+                dist[na] = (int) (sqrt( (x[i]-x[j])*(x[i]-x[j]) + (y[i]-y[j])*(y[i]-y[j]) ) + 0.5);
+                na++;
+            }
+            start[i+1] = na;
+        }
+        free( x );
+        free( y );
+    }
+    else
+    {
+        TSPInstance *inst = tspi_create( argv[1] );
+        n = tspi_size( inst );
+        start = xmalloc( sizeof(int)*(n+1) );
+        to = xmalloc( sizeof(int)*n*n );
+        dist = xmalloc( sizeof(int)*n*n );
+        start[0] = 0;
+        for ( int i=0 ; (i<n) ; ++i )
+        {
+            for ( int j=0 ; (j<n) ; ++j )
+            {
+                if ( i==j )
+                    continue;
+                if ( tspi_dist( inst, i, j ) == INT_MAX )
+                    continue;
+                to[na] = j;
+                dist[na] = tspi_dist( inst, i, j );
+                na++;
+            }
+            start[i+1] = na;
+        }
+        tspi_free( inst );
+    }
+
+    int nOrigins = n;
+    if ( !start )
+    {
+        nOrigins = argc>2 ? atoi( argv[2] ) : 64;
+        nOrigins = nOrigins<n ? nOrigins : n;
+    }
+    else
+    {
+        spf = spf_create();
+        spf_update_graph( spf, n, na, start, to, dist );
+    }
+
+    printf( "%d nodes, %d arcs, %d searches\n", n, na, nOrigins );
+
+    const struct
+    {
+        const char *name;
+        int layout;
+        double denseRatio;
+    } layouts[] = { { "aos", SPF_LAYOUT_AOS, 2.0 }, { "soa", SPF_LAYOUT_SOA, 2.0 },
+                    { "dense-aos", SPF_LAYOUT_AOS, 0.0 }, { "dense-soa", SPF_LAYOUT_SOA, 0.0 },
+                    { "compressed", SPF_LAYOUT_COMPRESSED, 2.0 } };
+    const int nLayouts = sizeof(layouts)/sizeof(layouts[0]);
+
+    long long refSum = 0;
+    for ( int l=0 ; (l<nLayouts) ; ++l )
+    {
+        spf_set_layout( spf, layouts[l].layout );
+        spf_set_dense_threshold( spf, layouts[l].denseRatio );
+        double secs;
+        const long long sum = all_searches( spf, n, nOrigins, &secs );
+        if ( l==0 )
+            refSum = sum;
+        printf( "%-12s %10.4f s  %10.2f us/search  %9.2f MB%s\n", layouts[l].name, secs, secs*1e6/nOrigins,
+                spf_graph_bytes( spf )/1048576.0, (sum!=refSum) ? "  DISTANCES DIFFER" : "" );
+    }
+
+    // lists with free slots, as after arc insertions and deletions
+    spf_set_layout( spf, SPF_LAYOUT_AOS );
+    spf_set_dense_threshold( spf, 2.0 );
+    int u = 0;
+    while ( start && u<n-1 && start[u+1]==start[u] )
+        ++u;
+    if ( start && start[u+1] > start[u] )
+    {
+        spf_delete_arc( spf, u, to[start[u]] );
+        spf_insert_arc( spf, u, to[start[u]], dist[start[u]] );
+
+        double secs;
+        const long long sum = all_searches( spf, n, nOrigins, &secs );
+        printf( "%-12s %10.4f s  %10.2f us/search  %9.2f MB%s\n", "aos-gaps", secs, secs*1e6/nOrigins,
+                spf_graph_bytes( spf )/1048576.0, (sum!=refSum) ? "  DISTANCES DIFFER" : "" );
+    }
+
+    spf_free( &spf );
+    free( start );
+    free( to );
+    free( dist );
+
+    return EXIT_SUCCESS;
+}
+
+static void *xmalloc( const size_t size )
+{
+    void *result = malloc( size );
+    if (!result)
+    {
+        fprintf(stderr, "No more memory available. Trying to allocate %zu bytes.", size);
+        abort();
+    }
+
+    return result;
+}
@@ -0,0 +1,381 @@
+/********************************************************************************
+ * spaths-server
+ *
+ * Loads a graph once and answers batches of shortest path queries read from
+ * stdin (answers written to stdout) or from clients of a Unix domain socket.
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0
+ *
+ ********************************************************************************/
+
+/**
+ * @file spaths-server.c
+ *
+ * Usage: spaths-server graph.gr [-l landmarks] [-t threads] [-s socketPath]
+ *
+ * Protocol: all values are 32 bit integers in native byte order. Each request
+ * starts with the header (type, count) and each response starts with the same
+ * header. Nodes are numbered from 0 as in ShortestPathsFinder.
+ *
+ *   type 1 distances: count pairs (origin, dest) follow, the response
+ *          has count distances
+ *   type 2 paths: count pairs (origin, dest) follow, the response has
+ *          for each query its distance, the number of nodes n of the
+ *          path (0 if there is no path) and the n nodes
+ *   type 3 info: count is 0, the response has count 2: nodes, arcs
+ *   type 0 quit: the server stops, there is no response
+ *
+ * Unreachable destinations have distance SP_INFTY_DIST and queries with
+ * invalid nodes have distance -1. Clients can send several requests before
+ * reading the responses, which are written in the same order. Requests with
+ * more than MAX_BATCH_QUERIES queries close the connection, larger batches
+ * have to be split by the client.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "spaths.h"
+
+#define REQ_QUIT  0
+#define REQ_DIST  1
+#define REQ_PATH  2
+#define REQ_INFO  3
+
+// smaller batches are answered by one thread
+#define PAR_MIN_QUERIES 64
+
+// larger batches are rejected
+#define MAX_BATCH_QUERIES (1<<20)
+
+// responses are written in pieces of this many values
+#define OUT_BUFFER_VALUES 65536
+
+typedef struct
+{
+    ShortestPathsFinder *spf;
+    int nContexts;
+    ShortestPathsFinder **contexts;   // one per thread
+    int **pathBuf;                    // one per thread
+
+    // batch buffers
+    size_t capQueries;
+    int32_t *queries;
+    int32_t *dist;
+    int32_t **paths;   // nodes of each path
+    int32_t *pathLen;
+    int nOut;
+    int32_t *out;      // OUT_BUFFER_VALUES values
+} Server;
+
+static void *xmalloc( const size_t size );
+
+/* returns 0 at end of file */
+static int read_all( int fd, void *buf, size_t size )
+{
+    char *p = buf;
+    while ( size )
+    {
+        const ssize_t r = read( fd, p, size );
+        if ( r < 0 && errno == EINTR )
+            continue;
+        if ( r <= 0 )
+            return 0;
+        p += r;
+        size -= r;
+    }
+
+    return 1;
+}
+
+static int write_all( int fd, const void *buf, size_t size )
+{
+    const char *p = buf;
+    while ( size )
+    {
+        const ssize_t r = write( fd, p, size );
+        if ( r < 0 && errno == EINTR )
+            continue;
+        if ( r <= 0 )
+            return 0;
+        p += r;
+        size -= r;
+    }
+
+    return 1;
+}
+
+/* count is at most MAX_BATCH_QUERIES */
+static void srv_reserve( Server *srv, int count )
+{
+    if ( (size_t) count <= srv->capQueries )
+        return;
+
+    if ( srv->capQueries )
+    {
+        free( srv->queries );
+        free( srv->dist );
+        free( srv->paths );
+        free( srv->pathLen );
+    }
+    srv->capQueries = ((size_t) count)*2;
+    srv->queries = xmalloc( sizeof(int32_t)*2*srv->capQueries );
+    srv->dist = xmalloc( sizeof(int32_t)*srv->capQueries );
+    srv->paths = xmalloc( sizeof(int32_t*)*srv->capQueries );
+    srv->pathLen = xmalloc( sizeof(int32_t)*srv->capQueries );
+}
+
+/* answers queries of the current batch, storing paths if requested */
+static void srv_answer( Server *srv, int count, int withPaths )
+{
+    const int nodes = spf_nodes( srv->spf );
+
+#pragma omp parallel for schedule(dynamic,16) num_threads(srv->nContexts) if(count>=PAR_MIN_QUERIES)
+    for ( int i=0 ; i<count ; ++i )
+    {
+#ifdef _OPENMP
+        const int t = omp_get_thread_num();
+#else
+        const int t = 0;
+#endif
+        ShortestPathsFinder *ctx = srv->contexts[t];
+        const int origin = srv->queries[2*i];
+        const int dest = srv->queries[2*i+1];
+        srv->pathLen[i] = 0;
+        srv->paths[i] = NULL;
+        if ( origin<0 || origin>=nodes || dest<0 || dest>=nodes )
+        {
+            srv->dist[i] = -1;
+            continue;
+        }
+
+        srv->dist[i] = spf_find_to( ctx, origin, dest );
+        if ( withPaths && srv->dist[i] < SP_INFTY_DIST )
+        {
+            int *path = srv->pathBuf[t];
+            int len = 1;
+            if ( origin==dest )
+                path[0] = origin;
+            else
+                len = spf_get_path( ctx, dest, path );
+            srv->pathLen[i] = len;
+            srv->paths[i] = xmalloc( sizeof(int32_t)*len );
+            memcpy( srv->paths[i], path, sizeof(int32_t)*len );
+        }
+    }
+}
+
+/* writes the buffered part of the response, returns 0 if the client is gone */
+static int srv_flush( Server *srv, int out )
+{
+    const int n = srv->nOut;
+    srv->nOut = 0;
+    return write_all( out, srv->out, sizeof(int32_t)*n );
+}
+
+/* appends a value to the response, writing the buffer when it is full */
+static int srv_put( Server *srv, int out, int32_t value )
+{
+    if ( srv->nOut == OUT_BUFFER_VALUES && !srv_flush( srv, out ) )
+        return 0;
+    srv->out[srv->nOut++] = value;
+    return 1;
+}
+
+/* serves requests until end of input, returns 1 if quit was requested */
+static int srv_serve( Server *srv, int in, int out )
+{
+    int32_t header[2];
+    while ( read_all( in, header, sizeof(header) ) )
+    {
+        const int type = header[0];
+        const int count = header[1];
+        if ( type == REQ_QUIT )
+            return 1;
+
+        if ( type == REQ_INFO )
+        {
+            const int32_t answer[4] = { REQ_INFO, 2, spf_nodes( srv->spf ), spf_arcs( srv->spf ) };
+            if ( !write_all( out, answer, sizeof(answer) ) )
+                return 0;
+            continue;
+        }
+
+        if ( (type!=REQ_DIST && type!=REQ_PATH) || count<0 || count>MAX_BATCH_QUERIES )
+        {
+            fprintf( stderr, "invalid request (type %d, count %d), closing connection\n", type, count );
+            return 0;
+        }
+
+        srv_reserve( srv, count );
+        if ( !read_all( in, srv->queries, sizeof(int32_t)*2*count ) )
+            return 0;
+
+        srv_answer( srv, count, type==REQ_PATH );
+
+        // responses of long paths may be larger than any buffer, they
+        // are written in pieces, all paths are freed even if writes fail
+        srv->nOut = 0;
+        int ok = srv_put( srv, out, type ) && srv_put( srv, out, count );
+        for ( int i=0 ; (i<count) ; ++i )
+        {
+            ok = ok && srv_put( srv, out, srv->dist[i] );
+            if ( type == REQ_PATH )
+            {
+                ok = ok && srv_put( srv, out, srv->pathLen[i] );
+                for ( int j=0 ; (ok && j<srv->pathLen[i]) ; ++j )
+                    ok = srv_put( srv, out, srv->paths[i][j] );
+                free( srv->paths[i] );
+            }
+        }
+
+        if ( !ok || !srv_flush( srv, out ) )
+            return 0;
+    }
+
+    return 0;
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc<2 )
+    {
+        fprintf( stderr, "usage: spaths-server graph.gr [-l landmarks] [-t threads] [-s socketPath]\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    int nLandmarks = 0;
+    int nThreads = 1;
+    const char *socketPath = NULL;
+#ifdef _OPENMP
+    nThreads = omp_get_max_threads();
+#endif
+    for ( int i=2 ; (i<argc) ; ++i )
+    {
+        if ( strcmp( argv[i], "-l" )==0 && i+1<argc )
+            nLandmarks = atoi( argv[++i] );
+        else if ( strcmp( argv[i], "-t" )==0 && i+1<argc )
+            nThreads = atoi( argv[++i] );
+        else if ( strcmp( argv[i], "-s" )==0 && i+1<argc )
+            socketPath = argv[++i];
+        else
+        {
+            fprintf( stderr, "invalid parameter: %s\n", argv[i] );
+            exit( EXIT_FAILURE );
+        }
+    }
+    nThreads = nThreads<1 ? 1 : nThreads;
+
+    // a client that leaves before reading its answer makes writes
+    // fail with EPIPE, it is dropped and the server goes on
+    signal( SIGPIPE, SIG_IGN );
+
+    Server srv;
+    memset( &srv, 0, sizeof(srv) );
+    srv.out = xmalloc( sizeof(int32_t)*OUT_BUFFER_VALUES );
+    srv.spf = spf_load_gr( argv[1] );
+    if ( nLandmarks )
+        spf_set_landmarks( srv.spf, nLandmarks );
+
+    srv.nContexts = nThreads;
+    srv.contexts = xmalloc( sizeof(ShortestPathsFinder*)*nThreads );
+    srv.pathBuf = xmalloc( sizeof(int*)*nThreads );
+    for ( int i=0 ; (i<nThreads) ; ++i )
+    {
+        srv.contexts[i] = spf_create_query( srv.spf );
+        srv.pathBuf[i] = xmalloc( sizeof(int)*spf_nodes( srv.spf ) );
+    }
+
+    fprintf( stderr, "graph with %d nodes and %d arcs loaded, %d landmarks, %d threads\n",
+             spf_nodes( srv.spf ), spf_arcs( srv.spf ), nLandmarks, nThreads );
+
+    if ( !socketPath )
+        srv_serve( &srv, STDIN_FILENO, STDOUT_FILENO );
+    else
+    {
+        const int sfd = socket( AF_UNIX, SOCK_STREAM, 0 );
+        if ( sfd < 0 )
+        {
+            perror( "socket" );
+            exit( EXIT_FAILURE );
+        }
+
+        struct sockaddr_un addr;
+        memset( &addr, 0, sizeof(addr) );
+        addr.sun_family = AF_UNIX;
+        if ( strlen( socketPath ) >= sizeof(addr.sun_path) )
+        {
+            fprintf( stderr, "socket path too long: %s\n", socketPath );
+            exit( EXIT_FAILURE );
+        }
+        strcpy( addr.sun_path, socketPath );
+        unlink( socketPath );
+        if ( bind( sfd, (struct sockaddr *) &addr, sizeof(addr) ) != 0 || listen( sfd, 16 ) != 0 )
+        {
+            perror( socketPath );
+            exit( EXIT_FAILURE );
+        }
+
+        // clients are served one at a time
+        int quit = 0;
+        while ( !quit )
+        {
+            const int cfd = accept( sfd, NULL, NULL );
+            if ( cfd < 0 )
+            {
+                if ( errno == EINTR )
+                    continue;
+                perror( "accept" );
+                break;
+            }
+            quit = srv_serve( &srv, cfd, cfd );
+            close( cfd );
+        }
+
+        close( sfd );
+        unlink( socketPath );
+    }
+
+    for ( int i=0 ; (i<nThreads) ; ++i )
+    {
+        spf_free( &srv.contexts[i] );
+        free( srv.pathBuf[i] );
+    }
+    free( srv.contexts );
+    free( srv.pathBuf );
+    spf_free( &srv.spf );
+    if ( srv.capQueries )
+    {
+        free( srv.queries );
+        free( srv.dist );
+        free( srv.paths );
+        free( srv.pathLen );
+    }
+    free( srv.out );
+
+    return EXIT_SUCCESS;
+}
+
+static void *xmalloc( const size_t size )
+{
+    void *result = malloc( size );
+    if (!result)
+    {
+        fprintf(stderr, "No more memory available. Trying to allocate %zu bytes.", size);
+        abort();
+    }
+
+    return result;
+}
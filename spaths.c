@@ -10,7 +10,15 @@
 #include <limits.h>
 #include <assert.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "spaths.h"
+#include "bigmem.h"
 
 /**
  * allocates a vector of strings
@@ -163,8 +171,16 @@ struct _ShortestPathsFinder
    // all neighbors
    Neighbor *neighs;
    // start of neighbors for node i
-   // the neighbor ends at startn[i+1]
+   // the neighbors end at endn[i]
    Neighbor **startn;
+   // endn = startn+1 while the lists are contiguous,
+   // after arcs are inserted or deleted each list i
+   // may have free slots up to limitn[i] and lists
+   // that grew are moved to neighs[nUsedArcs...]
+   Neighbor **endn;
+   int gapCapNodes;   // 0 if endn is startn+1
+   Neighbor **limitn;
+   int nUsedArcs;
 
    // solution
    int *dist;
@@ -180,19 +196,142 @@ struct _ShortestPathsFinder
 
    int **fwDist;
    int **fwPrev;
-};
-
-// lexicographical comparison
-int compArcsLX( void *a1, void *a2 )
-{
-   Arc *pa1 = (Arc *)a1;
-   Arc *pa2 = (Arc *)a2;
 
-   if (pa1->tail !=  pa2->tail)
-      return (pa1->tail - pa2->tail);
+   // dynamic mode: the shortest path tree
+   // computed for treeOrigin is repaired
+   // after each arc cost change
+   char dynamic;
+   int treeOrigin;
+
+   // arcs entering each node, for repairing
+   // the tree after cost increases: the arcs
+   // entering node i are rarc[rstart[i]...rstart[i+1]-1]
+   // and rarc stores positions in neighs
+   int dynCapNodes;
+   int dynCapArcs;
+   int *rstart;
+   int *rtail;
+   int *rarc;
+   char rValid;
+
+   // work space for the repair
+   int *queue;
+   char *ivAffected;
+
+   // arcs temporarily removed, with
+   // their original costs
+   int nRemoved;
+   int capRemoved;
+   Arc *removed;
+
+   // local searches (that stop early) only reset the
+   // nodes they settled: settled[0...nSettled-1] in
+   // the order they were settled, localValid=0
+   // indicates that a full reset is needed
+   int localCapNodes;
+   int nSettled;
+   int *settled;
+   int *source;   // origin of the path to each settled node
+   char localValid;
+   // targets of spf_find_targets, the search
+   // stops when nTargetsLeft reaches zero
+   char *isTarget;
+   int nTargetsLeft;
+   // arcs (spurNode,j) with spurSkip[j]!=0
+   // are ignored by local searches
+   int spurNode;
+   char *spurSkip;
+
+   // k shortest paths: nodes of the i-th path are
+   // kpNodes[kpStart[i]...kpStart[i+1]-1] and
+   // kpCum has the distance from origin to each node
+   int nkPaths;
+   int capkPaths;
+   int capkpNodes;
+   int *kpStart;
+   int *kpNodes;
+   int *kpCum;
+   int *kpDev;   // deviation index (Lawler)
+
+   // bucket width for delta-stepping,
+   // 0 if not computed yet
+   int delta;
+
+   // node renumbering for locality: nodes are stored
+   // in the order given by orderMethod, perm[i] is the
+   // internal index of node i and iperm the inverse,
+   // both NULL when nodes are not renumbered
+   int orderMethod;
+   int orderCapNodes;
+   int *perm;
+   int *iperm;
+   int *prevOut;      // previous with original indexes
+   int *settledOut;   // settled with original indexes
+
+   // node coordinates, for the space filling curve
+   int nCoords;
+   double *coordX;
+   double *coordY;
+
+   // structure of arrays layout: heads and costs of
+   // arcs in separate arrays, the arc in position k of
+   // neighs has head[k] and weight[k]
+   int layout;
+   int soaCapArcs;
+   int *head;
+   int *weight;
+
+   // compressed layout: the arcs of node u are encoded in
+   // cData[cStart[u]...cStart[u+1]-1] as pairs of varints: the
+   // zigzag difference between the head and the previous one
+   // (u for the first) and the zigzag cost, neighs and startn
+   // are freed, cCap=0 if not compressed or borrowed
+   size_t cCap;
+   unsigned char *cData;
+   unsigned int *cStart;
+
+   // dense mode: when arcs >= denseRatio*nodes*nodes spf_find
+   // scans the flat array of tentative distances instead of
+   // using the heap, arc costs are taken from the cost matrix
+   // denseW (SP_INFTY_DIST for missing arcs), built on demand
+   double denseRatio;
+   int denseCapNodes;
+   char denseValid;
+   int *denseW;
+   int *denseClosed;   // INT_MAX for settled nodes, 0 otherwise
+
+   // Johnson all pairs: node potentials computed by
+   // Bellman-Ford and reduced (non negative) costs
+   // of arcs, in the same positions of neighs
+   char jValid;
+   int jCapNodes;
+   int jCapArcs;
+   int *jPot;
+   int *jWeight;
+
+   // ALT landmarks for spf_find_to: lmFrom[v*nLandmarks+l]
+   // is the distance from landmark l to v and lmTo the
+   // distance from v to l, lmCap=0 if borrowed
+   int nLandmarks;
+   char lmValid;
+   size_t lmCap;
+   int *lmFrom;
+   int *lmTo;
+
+   // query contexts borrow the graph (and the structures derived
+   // from it) of their owner, which can't be changed while it
+   // has contexts. Contexts own only the data of their queries.
+   ShortestPathsFinder *owner;   // NULL if not a context
+   int nContexts;
+
+#ifdef SPF_STATS
+   SPFStats stats;
+#endif
+};
 
-   return ( pa1->head - pa2->head );
-}
+// translating nodes at the API boundary
+#define NODE_IN( spf, node ) ( (spf)->perm ? (spf)->perm[(node)] : (node) )
+#define NODE_OUT( spf, node ) ( ( ((spf)->iperm) && ((node)!=NULL_NODE) ) ? (spf)->iperm[(node)] : (node) )
 
 int compNeighs( const void *n1, const void *n2 )
 {
@@ -217,7 +356,171 @@ Neighbor *spf_end_n( ShortestPathsFinder* spf, const int node );
  * updates the working graph, the new graph
  * can have a different number of nodes/arcs
  */
-void spf_update_digraph( ShortestPathsFinder* spf, const int nodes, const int narcs, Arc *arcs );
+void spf_update_digraph( ShortestPathsFinder* spf, const int nodes, const int narcs, const Arc *arcs );
+
+/* graphs with at least this number of arcs
+ * are built in parallel
+ */
+#ifndef SPF_PAR_BUILD_ARCS
+#define SPF_PAR_BUILD_ARCS 1048576
+#endif
+
+/*
+ * fills neighs and startn with arcs
+ * grouped by tail and sorted by head
+ */
+static void spf_build_csr( ShortestPathsFinder* spf, const int narcs, const Arc *arcs, const int shift );
+static void spf_build_csr_parallel( ShortestPathsFinder* spf, const int narcs, const Arc *arcs, const int shift );
+
+// node renumbering
+/*
+ * renumbers the nodes of the current graph
+ * following spf->orderMethod
+ */
+static void spf_apply_order( ShortestPathsFinder* spf ) __attribute__((cold));
+/*
+ * fills newId with a new index for each (internal) node
+ */
+static void spf_order_bfs( const ShortestPathsFinder* spf, int newId[], const char reverse );
+static void spf_order_hilbert( const ShortestPathsFinder* spf, int newId[] );
+static void freeOrderSpace( ShortestPathsFinder* spf );
+
+/* fills head and weight from neighs when the SoA layout
+ * is active or compresses the lists (SPF_LAYOUT_COMPRESSED) */
+static void spf_sync_layout( ShortestPathsFinder* spf ) __attribute__((cold));
+
+static void spf_relax_soa( ShortestPathsFinder* spf, const int topNode, const int topCost ) __attribute__((hot));
+
+// compressed layout
+/*
+ * encodes the lists in cData and
+ * frees neighs and startn
+ */
+static void spf_compress( ShortestPathsFinder* spf ) __attribute__((cold));
+/*
+ * rebuilds neighs and startn from cData
+ */
+static void spf_decompress( ShortestPathsFinder* spf ) __attribute__((cold));
+static void freeCompressedSpace( ShortestPathsFinder* spf );
+static void spf_relax_compressed( ShortestPathsFinder* spf, const int topNode, const int topCost ) __attribute__((hot));
+/*
+ * stops with an error if spf uses the compressed
+ * layout, which only supports searches
+ */
+static void spf_check_flat( const ShortestPathsFinder* spf, const char *operation );
+
+/* zigzag: small negative and positive
+ * values as small unsigned values */
+static inline unsigned int spf_zigzag( const int v )
+{
+   return (((unsigned int)v)<<1) ^ ((unsigned int)(v>>31));
+}
+
+static inline int spf_unzigzag( const unsigned int u )
+{
+   return ((int)(u>>1)) ^ (-((int)(u&1)));
+}
+
+/* varints: 7 bits per byte, the high
+ * bit set in all bytes but the last */
+static inline unsigned char *spf_put_varint( unsigned char *p, unsigned int v )
+{
+   while ( v >= 0x80 )
+   {
+      *p++ = (unsigned char) (v | 0x80);
+      v >>= 7;
+   }
+   *p++ = (unsigned char) v;
+   return p;
+}
+
+static inline int spf_varint_size( unsigned int v )
+{
+   int size = 1;
+   for ( ; (v>=0x80) ; v>>=7 )
+      ++size;
+   return size;
+}
+
+static inline unsigned int spf_get_varint( const unsigned char **p )
+{
+   unsigned int v = *(*p)++;
+   if ( v < 0x80 )
+      return v;
+
+   v &= 0x7f;
+   int shift = 7;
+   unsigned int b;
+   do
+   {
+      b = *(*p)++;
+      v |= (b & 0x7f) << shift;
+      shift += 7;
+   } while ( b >= 0x80 );
+
+   return v;
+}
+
+/* Dijkstra over the reduced costs of Johnson's algorithm,
+ * with caller provided heap and arrays */
+static void spf_johnson_dijkstra( const ShortestPathsFinder* spf, NodePQueuePtr npq, const int origin,
+      int dist[], int previous[] ) __attribute__((hot));
+
+// memory used for rows in each
+// block of spf_johnson_to_file
+#ifndef SPF_JOHNSON_BLOCK_BYTES
+#define SPF_JOHNSON_BLOCK_BYTES (64*1048576)
+#endif
+
+/* O(n^2) Dijkstra for dense graphs */
+static void spf_find_dense( ShortestPathsFinder* spf, const int origin ) __attribute__((hot));
+
+static void spf_build_dense( ShortestPathsFinder* spf ) __attribute__((cold));
+
+// larger graphs never use the dense
+// mode, the cost matrix would not fit
+#ifndef SPF_DENSE_MAX_NODES
+#define SPF_DENSE_MAX_NODES 8192
+#endif
+
+#define SPF_USE_DENSE( spf ) ( ((spf)->nodes<=SPF_DENSE_MAX_NODES) && ((spf)->layout!=SPF_LAYOUT_COMPRESSED) && \
+      (((double)(spf)->arcs) >= (spf)->denseRatio*((double)(spf)->nodes)*((double)(spf)->nodes)) )
+
+// arcs processed in each block
+// of candidate distances
+#ifndef SPF_SOA_BLOCK
+#define SPF_SOA_BLOCK 16
+#endif
+
+// how many arcs ahead dist[head[k]]
+// is prefetched
+#ifndef SPF_PREFETCH_DIST
+#define SPF_PREFETCH_DIST 8
+#endif
+
+// minimum number of nodes for prefetching
+#ifndef SPF_PREFETCH_NODES
+#define SPF_PREFETCH_NODES 65536
+#endif
+
+// operation counters, only with -DSPF_STATS,
+// a heap update of a node with infinite
+// distance is a push, other updates are
+// decrease-keys
+#ifdef SPF_STATS
+#define SPF_COUNT( spf, counter, n ) ( (spf)->stats.counter += (n) )
+#define SPF_COUNT_UPDATE( spf, oldDist ) \
+   ( ((oldDist)==SP_INFTY_DIST) ? ++(spf)->stats.heapPushes : ++(spf)->stats.decreaseKeys )
+#else
+#define SPF_COUNT( spf, counter, n )
+#define SPF_COUNT_UPDATE( spf, oldDist )
+#endif
+
+// functions using internal node indexes
+static void arc_update( ShortestPathsFinder* spf, const int tail, const int head, const int cost );
+static void arc_remove( ShortestPathsFinder* spf, const int tail, const int head );
+static void arc_restore( ShortestPathsFinder* spf, const int tail, const int head );
+static int spf_path( const ShortestPathsFinder *spf, const int toNode, int indexes[] );
 
 // Floyd Warshall computing
 // space
@@ -232,6 +535,105 @@ void freeFWSpace( ShortestPathsFinder* spf );
 
 void spf_proccessFWLoop( ShortestPathsFinder* spf ) __attribute__((hot));
 
+// dynamic mode
+/*
+ * returns a pointer to arc (tail,head) in neighs
+ */
+static Neighbor *spf_arc( ShortestPathsFinder* spf, const int tail, const int head );
+/*
+ * allocates (if needed) the dynamic mode work space
+ * and builds the list of arcs entering each node
+ */
+static void allocateDynSpace( ShortestPathsFinder* spf ) __attribute__((cold));
+static void freeDynSpace( ShortestPathsFinder* spf ) __attribute__((cold));
+// arc insertions and deletions
+/*
+ * lists are contiguous again, called
+ * whenever startn is rebuilt
+ */
+static void spf_reset_gaps( ShortestPathsFinder* spf );
+/*
+ * copies the lists to a new neighs with free slots after
+ * each one and space at the end for lists that grow
+ */
+static void spf_spread_lists( ShortestPathsFinder* spf ) __attribute__((cold));
+/*
+ * moves the list of node to the end of
+ * neighs, with twice its size
+ */
+static void spf_move_list( ShortestPathsFinder* spf, const int node );
+/*
+ * returns arc (tail,head) or NULL if it does not exist
+ */
+static Neighbor *spf_find_arc( ShortestPathsFinder* spf, const int tail, const int head );
+
+// free slots left after a list of d arcs when
+// lists are spread: SPF_GAP_MIN + d/SPF_GAP_DIV
+#ifndef SPF_GAP_MIN
+#define SPF_GAP_MIN 2
+#endif
+#ifndef SPF_GAP_DIV
+#define SPF_GAP_DIV 4
+#endif
+
+/*
+ * graph changed: the tree and the
+ * reverse arcs are not valid anymore
+ */
+static void spf_invalidate_tree( ShortestPathsFinder* spf );
+/*
+ * repairs the shortest path tree after the cost
+ * of arc (tail,head) changed from oldCost to newCost
+ */
+static void spf_repair_tree( ShortestPathsFinder* spf, const int tail, const int head, const int oldCost, const int newCost );
+/*
+ * runs Dijkstra from the nodes already
+ * in the priority queue
+ */
+static void spf_propagate( ShortestPathsFinder* spf ) __attribute__((hot));
+
+// local searches
+/*
+ * resets dist and previous of nodes settled in the last
+ * local search (all nodes if a full search ran before)
+ */
+static void spf_reset_local( ShortestPathsFinder* spf );
+/*
+ * Dijkstra from origins which stops as soon as dest is
+ * settled (if dest!=NULL_NODE), when all marked targets
+ * are settled (if nTargetsLeft>0) or when the next node is
+ * farther than maxDist, nodes with blocked[i]!=0 are never
+ * entered. Only settled nodes keep their distances.
+ */
+static void spf_find_local( ShortestPathsFinder* spf, const int origins[], const int nOrigins,
+      const int maxDist, const int dest, const char *blocked ) __attribute__((hot));
+
+// ALT landmarks
+/*
+ * selects landmarks (farthest nodes) and computes
+ * distances from and to them
+ */
+static void spf_compute_landmarks( ShortestPathsFinder* spf ) __attribute__((cold));
+
+/* new finder with the arcs of spf (reversed if reverse is 1),
+ * nodes numbered as inside spf, the landmark searches run on
+ * it so that the results of the last search of spf are kept */
+static ShortestPathsFinder *spf_copy_graph( const ShortestPathsFinder* spf, const char reverse );
+
+// query contexts
+/*
+ * stops with an error if the graph of spf can't be
+ * changed: spf is a context or has contexts
+ */
+static void spf_check_mutable( const ShortestPathsFinder* spf, const char *operation );
+
+// delta-stepping
+/*
+ * chooses the bucket width from arc weights,
+ * returns 0 if there are arcs with cost <= 0
+ */
+static int spf_compute_delta( ShortestPathsFinder* spf ) __attribute__((cold));
+
 ShortestPathsFinderPtr spf_create( )
 {
    ShortestPathsFinderPtr result;
@@ -244,6 +646,10 @@ ShortestPathsFinderPtr spf_create( )
    result->arcs       = 0;
    result->neighs     = NULL;
    result->startn     = NULL;
+   result->endn       = NULL;
+   result->gapCapNodes = 0;
+   result->limitn     = NULL;
+   result->nUsedArcs  = 0;
    result->previous   = NULL;
    result->npq        = NULL;
    result->dist       = NULL;
@@ -255,12 +661,104 @@ ShortestPathsFinderPtr spf_create( )
    result->fwDist     = NULL;
    result->fwPrev     = NULL;
 
+   // dynamic mode
+   result->dynamic     = 0;
+   result->treeOrigin  = NULL_NODE;
+   result->dynCapNodes = 0;
+   result->dynCapArcs  = 0;
+   result->rstart      = NULL;
+   result->rtail       = NULL;
+   result->rarc        = NULL;
+   result->rValid      = 0;
+   result->queue       = NULL;
+   result->ivAffected  = NULL;
+   result->nRemoved    = 0;
+   result->capRemoved  = 0;
+   result->removed     = NULL;
+
+   // local searches
+   result->localCapNodes = 0;
+   result->nSettled      = 0;
+   result->settled       = NULL;
+   result->source        = NULL;
+   result->localValid    = 0;
+   result->isTarget      = NULL;
+   result->nTargetsLeft  = 0;
+   result->spurNode      = NULL_NODE;
+   result->spurSkip      = NULL;
+
+   // k shortest paths
+   result->nkPaths    = 0;
+   result->capkPaths  = 0;
+   result->capkpNodes = 0;
+   result->kpStart    = NULL;
+   result->kpNodes    = NULL;
+   result->kpCum      = NULL;
+   result->kpDev      = NULL;
+
+   result->delta      = 0;
+
+   // node renumbering
+   result->orderMethod   = SPF_ORDER_NONE;
+   result->orderCapNodes = 0;
+   result->perm          = NULL;
+   result->iperm         = NULL;
+   result->prevOut       = NULL;
+   result->settledOut    = NULL;
+   result->nCoords       = 0;
+   result->coordX        = NULL;
+   result->coordY        = NULL;
+
+   result->layout     = SPF_LAYOUT_AOS;
+   result->soaCapArcs = 0;
+   result->head       = NULL;
+   result->weight     = NULL;
+
+   result->cCap   = 0;
+   result->cData  = NULL;
+   result->cStart = NULL;
+
+   result->denseRatio    = 0.25;
+   result->denseCapNodes = 0;
+   result->denseValid    = 0;
+   result->denseW        = NULL;
+   result->denseClosed   = NULL;
+
+   result->jValid    = 0;
+   result->jCapNodes = 0;
+   result->jCapArcs  = 0;
+   result->jPot      = NULL;
+   result->jWeight   = NULL;
+
+   result->nLandmarks = 0;
+   result->lmValid    = 0;
+   result->lmCap      = 0;
+   result->lmFrom     = NULL;
+   result->lmTo       = NULL;
+
+   result->owner     = NULL;
+   result->nContexts = 0;
+
+#ifdef SPF_STATS
+   memset( &result->stats, 0, sizeof(SPFStats) );
+#endif
+
    return result;
 }
 
-void spf_find( ShortestPathsFinder* spf, const int origin )
+void spf_find( ShortestPathsFinder* spf, const int _origin )
 {
    NodePQueuePtr npq = spf->npq;
+   const int origin = NODE_IN( spf, _origin );
+   SPF_COUNT( spf, searches, 1 );
+
+   if ( SPF_USE_DENSE( spf ) )
+   {
+      spf_find_dense( spf, origin );
+      spf->treeOrigin = origin;
+      spf->localValid = 0;
+      return;
+   }
 
    npq_reset( npq );
    for ( int i=0 ; (i<spf->nodes) ; i++ )
@@ -269,15 +767,41 @@ void spf_find( ShortestPathsFinder* spf, const int origin )
       spf->previous[i] = NULL_NODE;
    spf->dist[origin] = 0;
    npq_update( npq, origin, 0 );
+   SPF_COUNT( spf, heapPushes, 1 );
+
+   spf_propagate( spf );
+
+   spf->treeOrigin = origin;
+   spf->localValid = 0;
+}
+
+static void spf_propagate( ShortestPathsFinder* spf )
+{
+   NodePQueuePtr npq = spf->npq;
 
    int topCost, topNode;
+   if ( spf->layout == SPF_LAYOUT_SOA )
+   {
+      while ( (topCost=npq_remove_first( npq, &topNode )) < SP_INFTY_DIST )
+         spf_relax_soa( spf, topNode, topCost );
+      return;
+   }
+   if ( spf->layout == SPF_LAYOUT_COMPRESSED )
+   {
+      while ( (topCost=npq_remove_first( npq, &topNode )) < SP_INFTY_DIST )
+         spf_relax_compressed( spf, topNode, topCost );
+      return;
+   }
+
    while ( (topCost=npq_remove_first( npq, &topNode )) < SP_INFTY_DIST )
    {
       //printf("top node: %d\n", topNode );
       // updating neighbors distances
       // by iterating in all neighbors
       Neighbor *n    = spf->startn[topNode];
-      Neighbor *endN = spf->startn[topNode+1];
+      Neighbor *endN = spf->endn[topNode];
+      SPF_COUNT( spf, settled, 1 );
+      SPF_COUNT( spf, relaxations, endN-n );
       for ( ; (n<endN) ; n++ )
       {
          const int toNode  = n->node;
@@ -285,6 +809,7 @@ void spf_find( ShortestPathsFinder* spf, const int origin )
          const int newDist = topCost + dist;
          if ( spf->dist[ toNode ] > newDist )
          {
+            SPF_COUNT_UPDATE( spf, spf->dist[toNode] );
             spf->previous[ toNode ] = topNode;
             spf->dist[ toNode ]     = newDist;
             npq_update( spf->npq, toNode, newDist );
@@ -293,13 +818,350 @@ void spf_find( ShortestPathsFinder* spf, const int origin )
    } // going through all nodes in priority queue
 }
 
-void spf_update_digraph( ShortestPathsFinder* spf, const int nodes, const int narcs, Arc *arcs )
+static void spf_relax_soa( ShortestPathsFinder* spf, const int topNode, const int topCost )
+{
+   const int first = spf->startn[topNode] - spf->neighs;
+   const int nArcs = spf->endn[topNode] - spf->startn[topNode];
+   const int *restrict head   = spf->head + first;
+   const int *restrict weight = spf->weight + first;
+   int *restrict dist = spf->dist;
+   // prefetching only pays off when dist does not fit in cache
+   const char prefetch = spf->nodes >= SPF_PREFETCH_NODES;
+   SPF_COUNT( spf, settled, 1 );
+   SPF_COUNT( spf, relaxations, nArcs );
+
+   int cand[SPF_SOA_BLOCK];
+   int better[SPF_SOA_BLOCK];
+   for ( int k=0 ; (k<nArcs) ; k+=SPF_SOA_BLOCK )
+   {
+      const int nb = (nArcs-k < SPF_SOA_BLOCK) ? nArcs-k : SPF_SOA_BLOCK;
+
+      if ( prefetch )
+         for ( int j=0 ; (j<nb) && (k+j+SPF_PREFETCH_DIST<nArcs) ; ++j )
+            __builtin_prefetch( dist + head[k+j+SPF_PREFETCH_DIST], 1 );
+
+      // candidate distances and improvements,
+      // no dependencies between arcs
+      int nBetter = 0;
+      for ( int j=0 ; (j<nb) ; ++j )
+      {
+         cand[j] = topCost + weight[k+j];
+         better[j] = dist[head[k+j]] > cand[j];
+         nBetter += better[j];
+      }
+      if ( !nBetter )
+         continue;
+
+      for ( int j=0 ; (j<nb) ; ++j )
+      {
+         const int toNode = head[k+j];
+         if ( (better[j]) && (dist[toNode] > cand[j]) )
+         {
+            SPF_COUNT_UPDATE( spf, dist[toNode] );
+            spf->previous[toNode] = topNode;
+            dist[toNode]          = cand[j];
+            npq_update( spf->npq, toNode, cand[j] );
+         }
+      }
+   }
+}
+
+static void spf_build_dense( ShortestPathsFinder* spf )
+{
+   const int nodes = spf->nodes;
+   if ( spf->denseCapNodes < nodes )
+   {
+      if ( spf->denseCapNodes )
+         free( spf->denseW );
+      spf->denseCapNodes = spf->capnodes;
+      spf->denseW = (int*) xmalloc( sizeof(int)*((size_t)spf->denseCapNodes)*((size_t)spf->denseCapNodes) );
+   }
+
+   for ( int i=0 ; (i<nodes) ; ++i )
+   {
+      int *row = spf->denseW + ((size_t)i)*nodes;
+      for ( int j=0 ; (j<nodes) ; ++j )
+         row[j] = SP_INFTY_DIST;
+      for ( const Neighbor *n=spf->startn[i] ; (n<spf->endn[i]) ; ++n )
+         row[n->node] = n->distance;
+   }
+
+   spf->denseValid = 1;
+}
+
+static void spf_find_dense( ShortestPathsFinder* spf, const int origin )
+{
+   const int nodes = spf->nodes;
+   if ( !spf->denseValid )
+      spf_build_dense( spf );
+   if ( !spf->denseClosed )
+      spf->denseClosed = (int*) xmalloc( sizeof(int)*spf->capnodes );
+
+   int *restrict dist = spf->dist;
+   int *restrict previous = spf->previous;
+   int *restrict closed = spf->denseClosed;
+   for ( int i=0 ; (i<nodes) ; i++ )
+      dist[i] = SP_INFTY_DIST;
+   for ( int i=0 ; (i<nodes) ; i++ )
+      previous[i] = NULL_NODE;
+   for ( int i=0 ; (i<nodes) ; i++ )
+      closed[i] = 0;
+   dist[origin] = 0;
+
+   int topNode = origin;
+   int topCost = 0;
+   for ( int it=0 ; (it<nodes) ; ++it )
+   {
+      closed[topNode] = INT_MAX;
+      SPF_COUNT( spf, settled, 1 );
+      SPF_COUNT( spf, relaxations, nodes );
+
+      // relaxing all arcs of topNode and computing the next
+      // minimum without branches, so that both loops are
+      // vectorized. Settled nodes never improve since costs
+      // are not negative.
+      const int *restrict row = spf->denseW + ((size_t)topNode)*nodes;
+      for ( int v=0 ; (v<nodes) ; ++v )
+      {
+         const int newDist = topCost + row[v];
+         const int better = newDist < dist[v];
+         dist[v]     = better ? newDist : dist[v];
+         previous[v] = better ? topNode : previous[v];
+      }
+
+      int best = INT_MAX;
+      for ( int v=0 ; (v<nodes) ; ++v )
+      {
+         const int key = dist[v] | closed[v];
+         best = key < best ? key : best;
+      }
+      if ( best >= SP_INFTY_DIST )
+         break;
+
+      topNode = 0;
+      while ( (dist[topNode] | closed[topNode]) != best )
+         ++topNode;
+      topCost = best;
+   }
+}
+
+void spf_set_dense_threshold( ShortestPathsFinder* spf, const double ratio )
+{
+   spf->denseRatio = ratio;
+}
+
+void spf_set_layout( ShortestPathsFinder* spf, const int layout )
+{
+   spf_check_mutable( spf, "spf_set_layout" );
+   if ( (layout!=SPF_LAYOUT_AOS) && (layout!=SPF_LAYOUT_SOA) && (layout!=SPF_LAYOUT_COMPRESSED) )
+   {
+      fprintf( stderr, "Error: invalid graph layout %d.\n", layout );
+      exit( EXIT_FAILURE );
+   }
+   if ( (layout==SPF_LAYOUT_COMPRESSED) && (spf->dynamic) )
+   {
+      fprintf( stderr, "Error: the compressed layout does not support the dynamic mode.\n" );
+      exit( EXIT_FAILURE );
+   }
+   if ( layout == spf->layout )
+      return;
+
+   if ( spf->cCap )
+      spf_decompress( spf );
+   spf->layout = layout;
+   spf_sync_layout( spf );
+}
+
+static void spf_sync_layout( ShortestPathsFinder* spf )
+{
+   if ( (spf->layout==SPF_LAYOUT_COMPRESSED) && (spf->nodes) )
+      spf_compress( spf );
+
+   if ( spf->layout != SPF_LAYOUT_SOA )
+   {
+      if ( spf->soaCapArcs )
+      {
+         free( spf->head );
+         free( spf->weight );
+         spf->head       = NULL;
+         spf->weight     = NULL;
+         spf->soaCapArcs = 0;
+      }
+      return;
+   }
+
+   if ( spf->soaCapArcs < spf->caparcs )
+   {
+      if ( spf->soaCapArcs )
+      {
+         free( spf->head );
+         free( spf->weight );
+      }
+      spf->soaCapArcs = spf->caparcs;
+      spf->head   = (int*) xmalloc( sizeof(int)*spf->soaCapArcs );
+      spf->weight = (int*) xmalloc( sizeof(int)*spf->soaCapArcs );
+   }
+
+   for ( int u=0 ; (u<spf->nodes) ; ++u )
+   {
+      for ( int k=spf->startn[u]-spf->neighs ; (k<spf->endn[u]-spf->neighs) ; ++k )
+      {
+         spf->head[k]   = spf->neighs[k].node;
+         spf->weight[k] = spf->neighs[k].distance;
+      }
+   }
+}
+
+static void spf_check_flat( const ShortestPathsFinder* spf, const char *operation )
+{
+   if ( spf->layout == SPF_LAYOUT_COMPRESSED )
+   {
+      fprintf( stderr, "Error: %s is not available in the compressed layout.\n", operation );
+      exit( EXIT_FAILURE );
+   }
+}
+
+static void spf_compress( ShortestPathsFinder* spf )
+{
+   const int nodes = spf->nodes;
+
+   // exact size first, so that huge graphs
+   // don't need a second copy of the arcs
+   size_t size = 0;
+   for ( int u=0 ; (u<nodes) ; ++u )
+   {
+      int prevHead = u;
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+      {
+         size += spf_varint_size( spf_zigzag( n->node-prevHead ) ) + spf_varint_size( spf_zigzag( n->distance ) );
+         prevHead = n->node;
+      }
+   }
+   if ( size > UINT_MAX )
+   {
+      fprintf( stderr, "Error: graph too large for the compressed layout (%zu bytes).\n", size );
+      exit( EXIT_FAILURE );
+   }
+
+   freeCompressedSpace( spf );
+   spf->cCap   = size ? size : 1;
+   spf->cData  = (unsigned char*) xmalloc( spf->cCap );
+   spf->cStart = (unsigned int*) xmalloc( sizeof(unsigned int)*(nodes+1) );
+   unsigned char *p = spf->cData;
+   for ( int u=0 ; (u<nodes) ; ++u )
+   {
+      spf->cStart[u] = p - spf->cData;
+      int prevHead = u;
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+      {
+         p = spf_put_varint( p, spf_zigzag( n->node-prevHead ) );
+         p = spf_put_varint( p, spf_zigzag( n->distance ) );
+         prevHead = n->node;
+      }
+   }
+   spf->cStart[nodes] = p - spf->cData;
+
+   // the flat lists are not kept
+   spf_reset_gaps( spf );
+   free( spf->neighs );
+   free( spf->startn );
+   spf->neighs    = NULL;
+   spf->startn    = NULL;
+   spf->endn      = NULL;
+   spf->caparcs   = 0;
+   spf->nUsedArcs = 0;
+   spf->rValid    = 0;
+   spf->jValid    = 0;
+}
+
+static void spf_decompress( ShortestPathsFinder* spf )
+{
+   const int nodes = spf->nodes;
+
+   spf->caparcs = spf->arcs ? spf->arcs : 1;
+   spf->neighs  = (Neighbor*) xmalloc( sizeof(Neighbor)*spf->caparcs );
+   spf->startn  = (Neighbor**) xmalloc( sizeof(Neighbor*)*(spf->capnodes+1) );
+   Neighbor *pn = spf->neighs;
+   for ( int u=0 ; (u<nodes) ; ++u )
+   {
+      spf->startn[u] = pn;
+      const unsigned char *p   = spf->cData + spf->cStart[u];
+      const unsigned char *end = spf->cData + spf->cStart[u+1];
+      int head = u;
+      while ( p<end )
+      {
+         head += spf_unzigzag( spf_get_varint( &p ) );
+         pn->node     = head;
+         pn->distance = spf_unzigzag( spf_get_varint( &p ) );
+         ++pn;
+      }
+   }
+   spf->startn[nodes] = pn;
+
+   freeCompressedSpace( spf );
+   spf_reset_gaps( spf );
+}
+
+static void freeCompressedSpace( ShortestPathsFinder* spf )
+{
+   if ( spf->cCap )
+   {
+      spf->cCap = 0;
+      free( spf->cData );
+      free( spf->cStart );
+   }
+   spf->cData  = NULL;
+   spf->cStart = NULL;
+}
+
+static void spf_relax_compressed( ShortestPathsFinder* spf, const int topNode, const int topCost )
+{
+   const unsigned char *p   = spf->cData + spf->cStart[topNode];
+   const unsigned char *end = spf->cData + spf->cStart[topNode+1];
+   int *dist = spf->dist;
+   SPF_COUNT( spf, settled, 1 );
+
+   int toNode = topNode;
+   while ( p<end )
+   {
+      toNode += spf_unzigzag( spf_get_varint( &p ) );
+      const int newDist = topCost + spf_unzigzag( spf_get_varint( &p ) );
+      SPF_COUNT( spf, relaxations, 1 );
+      if ( dist[toNode] > newDist )
+      {
+         SPF_COUNT_UPDATE( spf, dist[toNode] );
+         spf->previous[toNode] = topNode;
+         dist[toNode]          = newDist;
+         npq_update( spf->npq, toNode, newDist );
+      }
+   }
+}
+
+size_t spf_graph_bytes( const ShortestPathsFinder* spf )
+{
+   if ( spf->cCap )
+      return spf->cCap + sizeof(unsigned int)*(spf->nodes+1);
+
+   size_t bytes = sizeof(Neighbor)*((size_t)spf->caparcs) + sizeof(Neighbor*)*((size_t)spf->capnodes+1);
+   if ( spf->gapCapNodes )
+      bytes += 2*sizeof(Neighbor*)*((size_t)spf->gapCapNodes);
+   if ( spf->soaCapArcs )
+      bytes += 2*sizeof(int)*((size_t)spf->soaCapArcs);
+
+   return bytes;
+}
+
+void spf_update_digraph( ShortestPathsFinder* spf, const int nodes, const int narcs, const Arc *arcs )
 {
+   spf_check_mutable( spf, "spf_update_digraph" );
    assert( narcs );
+   spf_invalidate_tree( spf );
+   freeOrderSpace( spf );
+   freeCompressedSpace( spf );
    spf->nodes = nodes;
    spf->arcs  = narcs;
 
-   if (nodes > spf->capnodes )
+   if ( (nodes > spf->capnodes) || (!spf->startn) )
    {
       if ( spf->startn )
          free( spf->startn );
@@ -307,8 +1169,15 @@ void spf_update_digraph( ShortestPathsFinder* spf, const int nodes, const int na
          free( spf->previous );
       if ( spf->dist )
          free( spf->dist );
+      if ( spf->path )
+         free( spf->path );
       if ( spf->npq )
          npq_free( &(spf->npq) );
+      if ( spf->denseClosed )
+      {
+         free( spf->denseClosed );
+         spf->denseClosed = NULL;
+      }
 
       spf->capnodes = nodes;
       if (nodes<1000)
@@ -337,72 +1206,123 @@ void spf_update_digraph( ShortestPathsFinder* spf, const int nodes, const int na
       spf->neighs = (Neighbor*) xmalloc( sizeof(Neighbor)*spf->caparcs );
    }
 
-   qsort( (void *)arcs, narcs, sizeof(Arc), (__compar_fn_t)compArcsLX );
-
-   if ( arcs[0].tail )  // not starting in zero ... fixing
-   {
-      int shift = arcs[0].tail;
-      Arc *ptr = arcs;
-      Arc *ptrEnd = arcs + narcs;
-      for ( ; (ptr<ptrEnd) ; ptr++ )
-      {
-         ptr->tail -= shift;
-         ptr->head -= shift;
-      }
-   }
-
-   Arc *currArc        = arcs;
-   Arc *endArcs        = currArc + narcs;
+   // not starting in zero ... fixing
+   int shift = INT_MAX;
+   for ( const Arc *a=arcs ; (a<arcs+narcs) ; ++a )
+      if ( a->tail < shift )
+         shift = a->tail;
 
    //validating contents (only in debug)
 #ifdef DEBUG
-   for (  ; (currArc<endArcs) ; currArc++ )
+   for ( const Arc *a=arcs ; (a<arcs+narcs) ; ++a )
    {
-      assert( (currArc->head >= 0) );
-      assert( (currArc->head < narcs) );
-      assert( (currArc->tail >= 0) );
-      assert( (currArc->tail < narcs) );
+      assert( (a->head-shift >= 0) );
+      assert( (a->head-shift < nodes) );
+      assert( (a->tail-shift >= 0) );
+      assert( (a->tail-shift < nodes) );
    }
 #endif
 
-   // filling default values for startn
-   for ( int i=0 ; (i<=nodes) ; i++ )
-      spf->startn[i] = NULL;
+#ifdef _OPENMP
+   if ( narcs >= SPF_PAR_BUILD_ARCS )
+      spf_build_csr_parallel( spf, narcs, arcs, shift );
+   else
+#endif
+      spf_build_csr( spf, narcs, arcs, shift );
+
+   spf_reset_gaps( spf );
+   spf_apply_order( spf );
+   spf_sync_layout( spf );
+}
 
-   int currNode = -1;
-   Neighbor *currNeigh = spf->neighs;
-   currArc = arcs;
-   endArcs = arcs + narcs;
-   Neighbor *lastValid = NULL;
-PROCCESS_ARC:
-   if ( currArc>=endArcs )
-      goto END_ARCS;
-   if ( currArc->tail != currNode )
+static void spf_build_csr( ShortestPathsFinder* spf, const int narcs, const Arc *arcs, const int shift )
+{
+   const int nodes = spf->nodes;
+   int *pos   = (int*) xmalloc( sizeof(int)*(nodes+1) );
+   int *order = (int*) xmalloc( sizeof(int)*narcs );
+
+   // counting sort by head
+   memset( pos, 0, sizeof(int)*(nodes+1) );
+   for ( int i=0 ; (i<narcs) ; ++i )
+      ++pos[arcs[i].head-shift+1];
+   for ( int i=1 ; (i<=nodes) ; ++i )
+      pos[i] += pos[i-1];
+   for ( int i=0 ; (i<narcs) ; ++i )
+      order[pos[arcs[i].head-shift]++] = i;
+
+   // stable counting sort by tail
+   memset( pos, 0, sizeof(int)*(nodes+1) );
+   for ( int i=0 ; (i<narcs) ; ++i )
+      ++pos[arcs[i].tail-shift+1];
+   for ( int i=1 ; (i<=nodes) ; ++i )
+      pos[i] += pos[i-1];
+   for ( int i=0 ; (i<=nodes) ; ++i )
+      spf->startn[i] = spf->neighs + pos[i];
+   for ( int i=0 ; (i<narcs) ; ++i )
    {
-      currNode = currArc->tail;
-      spf->startn[currNode] = currNeigh;
+      const Arc *a = arcs + order[i];
+      Neighbor *n = spf->neighs + pos[a->tail-shift]++;
+      n->node     = a->head-shift;
+      n->distance = a->distance;
    }
 
-   currNeigh->node = currArc->head;
-   currNeigh->distance = currArc->distance;
-
-   ++currArc;
-   ++currNeigh;
-   goto PROCCESS_ARC;
-END_ARCS:
+   free( pos );
+   free( order );
+}
 
-   lastValid = currNeigh;
-   for ( int i=nodes ; (i>=0) ; i-- )
+static void spf_build_csr_parallel( ShortestPathsFinder* spf, const int narcs, const Arc *arcs, const int shift )
+{
+   const int nodes = spf->nodes;
+   int *pos = (int*) xmalloc( sizeof(int)*(nodes+1) );
+
+   // counting arcs per tail
+#pragma omp parallel for schedule(static)
+   for ( int i=0 ; i<=nodes ; ++i )
+      pos[i] = 0;
+#pragma omp parallel for schedule(static)
+   for ( int i=0 ; i<narcs ; ++i )
+      __atomic_fetch_add( pos+arcs[i].tail-shift+1, 1, __ATOMIC_RELAXED );
+   for ( int i=1 ; (i<=nodes) ; ++i )
+      pos[i] += pos[i-1];
+   for ( int i=0 ; (i<=nodes) ; ++i )
+      spf->startn[i] = spf->neighs + pos[i];
+
+   // arcs of the same tail arrive in any order
+#pragma omp parallel for schedule(static)
+   for ( int i=0 ; i<narcs ; ++i )
    {
-      if ( !spf->startn[i] )
-         spf->startn[i] = lastValid;
-      else
-         lastValid = spf->startn[i];
+      const Arc *a = arcs + i;
+      Neighbor *n = spf->neighs + __atomic_fetch_add( pos+a->tail-shift, 1, __ATOMIC_RELAXED );
+      n->node     = a->head-shift;
+      n->distance = a->distance;
    }
-}
 
-int spf_nodes( ShortestPathsFinder* spf )
-{
+   // so, sorting each list by head
+#pragma omp parallel for schedule(dynamic,256)
+   for ( int u=0 ; u<nodes ; ++u )
+   {
+      Neighbor *start = spf->startn[u];
+      const int deg = spf->startn[u+1]-start;
+      if ( deg > 16 )
+      {
+         qsort( start, deg, sizeof(Neighbor), compNeighs );
+         continue;
+      }
+      for ( int i=1 ; (i<deg) ; ++i )
+      {
+         const Neighbor key = start[i];
+         int j = i-1;
+         for ( ; (j>=0) && (start[j].node>key.node) ; --j )
+            start[j+1] = start[j];
+         start[j+1] = key;
+      }
+   }
+
+   free( pos );
+}
+
+int spf_nodes( ShortestPathsFinder* spf )
+{
    return spf->nodes;
 }
 
@@ -411,6 +1331,24 @@ int spf_arcs( ShortestPathsFinder* spf )
    return spf->arcs;
 }
 
+SPFStats spf_stats( const ShortestPathsFinder* spf )
+{
+#ifdef SPF_STATS
+   return spf->stats;
+#else
+   SPFStats stats;
+   memset( &stats, 0, sizeof(SPFStats) );
+   return stats;
+#endif
+}
+
+void spf_reset_stats( ShortestPathsFinder* spf )
+{
+#ifdef SPF_STATS
+   memset( &spf->stats, 0, sizeof(SPFStats) );
+#endif
+}
+
 Neighbor *spf_start_n( ShortestPathsFinder* spf, const int node )
 {
    return spf->startn[node];
@@ -418,27 +1356,43 @@ Neighbor *spf_start_n( ShortestPathsFinder* spf, const int node )
 
 Neighbor *spf_end_n( ShortestPathsFinder* spf, const int node )
 {
-   return spf->startn[node+1];
+   return spf->endn[node];
 }
 
 int spf_get_dist( const ShortestPathsFinderPtr spf, const int node )
 {
    assert( node < spf->nodes );
-   return spf->dist[ node ];
+   return spf->dist[ NODE_IN( spf, node ) ];
 }
 
 int spf_get_previous( const ShortestPathsFinderPtr spf, const int node )
 {
    assert( node < spf->nodes );
-   return spf->previous[ node ];
+   return NODE_OUT( spf, spf->previous[ NODE_IN( spf, node ) ] );
 }
 
 int *spf_previous( const ShortestPathsFinder *spf )
 {
-   return spf->previous;
+   if ( !spf->perm )
+      return spf->previous;
+
+   for ( int i=0 ; (i<spf->nodes) ; ++i )
+      spf->prevOut[i] = NODE_OUT( spf, spf->previous[spf->perm[i]] );
+
+   return spf->prevOut;
 }
 
 int spf_get_path( const ShortestPathsFinder *spf, const int toNode, int indexes[] )
+{
+   const int n = spf_path( spf, NODE_IN( spf, toNode ), indexes );
+   if ( spf->iperm )
+      for ( int i=0 ; (i<n) ; ++i )
+         indexes[i] = spf->iperm[indexes[i]];
+
+   return n;
+}
+
+static int spf_path( const ShortestPathsFinder *spf, const int toNode, int indexes[] )
 {
    // filling first in path
    int currNode = spf->previous[toNode];
@@ -462,8 +1416,11 @@ int spf_get_path( const ShortestPathsFinder *spf, const int toNode, int indexes[
    return ( n );
 }
 
-int spf_get_path_fw( const ShortestPathsFinder *spf, const int fromNode, const int toNode, int indexes[] )
+int spf_get_path_fw( const ShortestPathsFinder *spf, const int _fromNode, const int _toNode, int indexes[] )
 {
+   const int fromNode = NODE_IN( spf, _fromNode );
+   const int toNode   = NODE_IN( spf, _toNode );
+
    // filling first in path
    int currNode = spf->fwPrev[fromNode][toNode];
    if ( currNode == NULL_NODE )
@@ -481,14 +1438,159 @@ int spf_get_path_fw( const ShortestPathsFinder *spf, const int fromNode, const i
    const int n = ptrIdx-spf->path;
    --ptrIdx;
    for ( int i=0 ; (i<n) ; ++i,--ptrIdx )
-      indexes[i] = *ptrIdx;
+      indexes[i] = NODE_OUT( spf, *ptrIdx );
 
    return ( n );
 }
 
+static void spf_check_mutable( const ShortestPathsFinder* spf, const char *operation )
+{
+   if ( spf->owner )
+   {
+      fprintf( stderr, "Error: %s called on a query context, contexts are read only.\n", operation );
+      exit( EXIT_FAILURE );
+   }
+   if ( spf->nContexts )
+   {
+      fprintf( stderr, "Error: %s called while the graph is shared by %d query contexts.\n", operation, spf->nContexts );
+      exit( EXIT_FAILURE );
+   }
+}
+
+ShortestPathsFinder *spf_create_query( ShortestPathsFinder* spf )
+{
+   ShortestPathsFinder *owner = spf->owner ? spf->owner : spf;
+
+   // structures that spf_find builds on demand are built
+   // now, so that contexts only read the shared data
+   if ( (SPF_USE_DENSE( owner )) && (!owner->denseValid) )
+      spf_build_dense( owner );
+   if ( (owner->nLandmarks) && (!owner->lmValid) && (owner->layout!=SPF_LAYOUT_COMPRESSED) )
+      spf_compute_landmarks( owner );
+
+   ShortestPathsFinder *result = spf_create();
+   result->owner = owner;
+
+   // shared graph
+   result->capnodes    = owner->capnodes;
+   result->caparcs     = owner->caparcs;
+   result->nodes       = owner->nodes;
+   result->arcs        = owner->arcs;
+   result->neighs      = owner->neighs;
+   result->startn      = owner->startn;
+   result->endn        = owner->endn;
+   result->nUsedArcs   = owner->nUsedArcs;
+   result->layout      = owner->layout;
+   result->head        = owner->head;
+   result->weight      = owner->weight;
+   result->cData       = owner->cData;
+   result->cStart      = owner->cStart;
+   result->orderMethod = owner->orderMethod;
+   result->perm        = owner->perm;
+   result->iperm       = owner->iperm;
+   result->denseRatio  = owner->denseRatio;
+   result->denseValid  = owner->denseValid;
+   result->denseW      = owner->denseW;
+   result->jValid      = owner->jValid;
+   result->jPot        = owner->jPot;
+   result->jWeight     = owner->jWeight;
+   result->delta       = owner->delta;
+   result->nLandmarks  = owner->nLandmarks;
+   result->lmValid     = owner->lmValid;
+   result->lmFrom      = owner->lmFrom;
+   result->lmTo        = owner->lmTo;
+
+   // data of queries
+   if ( owner->capnodes )
+   {
+      result->npq      = npq_create( owner->capnodes, SP_INFTY_DIST );
+      result->previous = (int*) xmalloc( sizeof(int)*owner->capnodes );
+      result->dist     = (int*) xmalloc( sizeof(int)*owner->capnodes );
+      result->path     = (int*) xmalloc( sizeof(int)*owner->capnodes );
+   }
+   if ( owner->perm )
+   {
+      result->orderCapNodes = owner->orderCapNodes;
+      result->prevOut    = (int*) xmalloc( sizeof(int)*owner->orderCapNodes );
+      result->settledOut = (int*) xmalloc( sizeof(int)*owner->orderCapNodes );
+   }
+
+   __atomic_add_fetch( &owner->nContexts, 1, __ATOMIC_RELAXED );
+
+   return result;
+}
+
 void spf_free( ShortestPathsFinderPtr *spf )
 {
+   if ( (*spf)->nContexts )
+   {
+      fprintf( stderr, "Error: ShortestPathsFinder freed while still used by %d query contexts.\n", (*spf)->nContexts );
+      exit( EXIT_FAILURE );
+   }
+   if ( (*spf)->owner )
+   {
+      // borrowed data, the remaining
+      // shared arrays have capacity 0
+      (*spf)->neighs = NULL;
+      (*spf)->startn = NULL;
+      (*spf)->endn   = NULL;
+      (*spf)->perm   = NULL;
+      (*spf)->iperm  = NULL;
+      __atomic_sub_fetch( &((*spf)->owner->nContexts), 1, __ATOMIC_RELAXED );
+   }
+
    freeFWSpace( *spf );
+   freeDynSpace( *spf );
+   if ( (*spf)->removed )
+      free( (*spf)->removed );
+   freeOrderSpace( *spf );
+   if ( (*spf)->gapCapNodes )
+   {
+      free( (*spf)->endn );
+      free( (*spf)->limitn );
+   }
+   freeCompressedSpace( *spf );
+   if ( (*spf)->soaCapArcs )
+   {
+      free( (*spf)->head );
+      free( (*spf)->weight );
+   }
+   if ( (*spf)->denseCapNodes )
+      free( (*spf)->denseW );
+   if ( (*spf)->denseClosed )
+      free( (*spf)->denseClosed );
+   if ( (*spf)->jCapNodes )
+   {
+      free( (*spf)->jPot );
+      free( (*spf)->jWeight );
+   }
+   if ( (*spf)->lmCap )
+   {
+      free( (*spf)->lmFrom );
+      free( (*spf)->lmTo );
+   }
+   if ( (*spf)->coordX )
+   {
+      free( (*spf)->coordX );
+      free( (*spf)->coordY );
+   }
+   if ( (*spf)->settled )
+   {
+      free( (*spf)->settled );
+      free( (*spf)->source );
+      free( (*spf)->isTarget );
+      free( (*spf)->spurSkip );
+   }
+   if ( (*spf)->kpStart )
+   {
+      free( (*spf)->kpStart );
+      free( (*spf)->kpDev );
+   }
+   if ( (*spf)->kpNodes )
+   {
+      free( (*spf)->kpNodes );
+      free( (*spf)->kpCum );
+   }
 
    if ( (*spf)->neighs )
       free ( (*spf)->neighs );
@@ -516,16 +1618,16 @@ void allocateFWSpace( ShortestPathsFinder* spf )
       spf->fwCapNodes = spf->nodes;
       spf->fwCapArcs  = spf->arcs;
 
-      const int cells = spf->fwCapNodes*spf->fwCapNodes;
+      const size_t cells = ((size_t)spf->fwCapNodes)*spf->fwCapNodes;
 
-      // allocating
+      // allocating, tables on huge pages
       spf->fwDist = (int **)xmalloc( sizeof(int*)*spf->fwCapNodes );
-      spf->fwDist[0] = (int *) xmalloc( sizeof(int)*cells );
+      spf->fwDist[0] = (int *) bm_alloc( sizeof(int)*cells );
       for ( int i=1 ; (i<spf->fwCapNodes) ; ++i )
          spf->fwDist[i] = spf->fwDist[i-1]+spf->fwCapNodes;
 
       spf->fwPrev = (int **)xmalloc( sizeof(int*)*spf->fwCapNodes );
-      spf->fwPrev[0] = (int *)xmalloc( sizeof(int)*cells );
+      spf->fwPrev[0] = (int *) bm_alloc( sizeof(int)*cells );
       for ( int i=1 ; (i<spf->fwCapNodes) ; ++i )
          spf->fwPrev[i] = spf->fwPrev[i-1]+spf->fwCapNodes;
    }
@@ -545,7 +1647,7 @@ void allocateFWSpace( ShortestPathsFinder* spf )
    for ( int i=0 ; (i<spf->nodes) ; ++i )
    {
       Neighbor *n = spf->startn[i];
-      Neighbor *e = spf->startn[i+1];
+      Neighbor *e = spf->endn[i];
 
       for ( ; (n<e) ; ++n )
       {
@@ -581,6 +1683,7 @@ void spf_proccessFWLoop( ShortestPathsFinder* spf )
 
 void spf_fw_find( ShortestPathsFinder* spf )
 {
+   spf_check_flat( spf, "spf_fw_find" );
    allocateFWSpace( spf );
 
    spf_proccessFWLoop( spf );
@@ -596,7 +1699,7 @@ int spf_fw_get_dist( ShortestPathsFinder* spf, const int i, const int j )
    assert( j<spf->nodes );
 #endif
 
-   return spf->fwDist[i][j];
+   return spf->fwDist[NODE_IN( spf, i )][NODE_IN( spf, j )];
 }
 
 
@@ -742,42 +1845,504 @@ ShortestPathsFinder *spf_load_gr( const char *fileName )
 #undef STR_SIZE
 }
 
-void spf_update_arc( ShortestPathsFinder* spf, const int tail, const int head, const int cost )
+static Neighbor *spf_arc( ShortestPathsFinder* spf, const int tail, const int head )
 {
-   const Neighbor *start  = spf->startn[ tail ];
-   const Neighbor *end    = spf->startn[ tail+1 ];
-   const Neighbor key     = { head, 0 };
-   Neighbor *result = (Neighbor *)bsearch( &key, start, end-start, sizeof(Neighbor), &compNeighs );
+   Neighbor *result = spf_find_arc( spf, tail, head );
    assert( ( (result) && (result->node==head) ) );
-   result->distance = cost;
+   return result;
 }
 
-int spf_get_arc( ShortestPathsFinder* spf, const int tail, const int head )
+static Neighbor *spf_find_arc( ShortestPathsFinder* spf, const int tail, const int head )
 {
    const Neighbor *start  = spf->startn[ tail ];
-   const Neighbor *end    = spf->startn[ tail+1 ];
+   const Neighbor *end    = spf->endn[tail];
    const Neighbor key     = { head, 0 };
-   const Neighbor *result = (const Neighbor *) bsearch( &key, start, end-start, sizeof(Neighbor), &compNeighs );
-   assert( ( (result) && (result->node==head) ) );
-   return result->distance;
+   return (Neighbor *)bsearch( &key, start, end-start, sizeof(Neighbor), &compNeighs );
+}
+
+void spf_update_arc( ShortestPathsFinder* spf, const int tail, const int head, const int cost )
+{
+   spf_check_mutable( spf, "spf_update_arc" );
+   spf_check_flat( spf, "spf_update_arc" );
+   arc_update( spf, NODE_IN( spf, tail ), NODE_IN( spf, head ), cost );
+}
+
+static void arc_update( ShortestPathsFinder* spf, const int tail, const int head, const int cost )
+{
+   Neighbor *arc = spf_arc( spf, tail, head );
+   const int oldCost = arc->distance;
+   arc->distance = cost;
+   if ( spf->weight )
+      spf->weight[arc-spf->neighs] = cost;
+   if ( spf->denseValid )
+      spf->denseW[((size_t)tail)*spf->nodes+head] = cost;
+   if ( oldCost != cost )
+   {
+      spf->jValid  = 0;
+      spf->lmValid = 0;
+      spf->delta   = 0;
+   }
+
+   if ( (spf->dynamic) && (spf->treeOrigin!=NULL_NODE) && (oldCost!=cost) )
+      spf_repair_tree( spf, tail, head, oldCost, cost );
+}
+
+int spf_get_arc( ShortestPathsFinder* spf, const int tail, const int head )
+{
+   spf_check_flat( spf, "spf_get_arc" );
+   return spf_arc( spf, NODE_IN( spf, tail ), NODE_IN( spf, head ) )->distance;
 }
 
 void spf_temp_remove_arc( ShortestPathsFinder* spf, const int tail, const int head )
 {
-   spf_update_arc( spf, tail, head, SP_INFTY_DIST );
+   spf_check_mutable( spf, "spf_temp_remove_arc" );
+   spf_check_flat( spf, "spf_temp_remove_arc" );
+   arc_remove( spf, NODE_IN( spf, tail ), NODE_IN( spf, head ) );
+}
+
+static void arc_remove( ShortestPathsFinder* spf, const int tail, const int head )
+{
+   const int cost = spf_arc( spf, tail, head )->distance;
+   if ( cost == SP_INFTY_DIST )   // already removed
+      return;
+
+   ADJUST_VECTOR_CAPACITY( spf->removed, spf->capRemoved, spf->nRemoved+1 );
+   Arc *rarc = spf->removed + spf->nRemoved;
+   rarc->tail     = tail;
+   rarc->head     = head;
+   rarc->distance = cost;
+   ++spf->nRemoved;
+
+   arc_update( spf, tail, head, SP_INFTY_DIST );
 }
 
 void spf_restore_arc( ShortestPathsFinder* spf, const int tail, const int head )
 {
-   spf_update_arc( spf, tail, head, SP_INFTY_DIST );
+   spf_check_mutable( spf, "spf_restore_arc" );
+   spf_check_flat( spf, "spf_restore_arc" );
+   arc_restore( spf, NODE_IN( spf, tail ), NODE_IN( spf, head ) );
+}
+
+static void arc_restore( ShortestPathsFinder* spf, const int tail, const int head )
+{
+   // arcs are usually restored in the
+   // reverse order of removal
+   int i = spf->nRemoved-1;
+   for ( ; (i>=0) ; --i )
+      if ( (spf->removed[i].tail==tail) && (spf->removed[i].head==head) )
+         break;
+
+   if ( i<0 )
+   {
+      fprintf( stderr, "Error: arc (%d,%d) was not temporarily removed.\n", NODE_OUT( spf, tail ), NODE_OUT( spf, head ) );
+      exit( EXIT_FAILURE );
+   }
+
+   const int cost = spf->removed[i].distance;
+   spf->removed[i] = spf->removed[spf->nRemoved-1];
+   --spf->nRemoved;
+
+   arc_update( spf, tail, head, cost );
+}
+
+void spf_insert_arc( ShortestPathsFinder* spf, const int _tail, const int _head, const int cost )
+{
+   spf_check_mutable( spf, "spf_insert_arc" );
+   spf_check_flat( spf, "spf_insert_arc" );
+   const int tail = NODE_IN( spf, _tail );
+   const int head = NODE_IN( spf, _head );
+
+   if ( spf_find_arc( spf, tail, head ) )
+   {
+      arc_update( spf, tail, head, cost );
+      return;
+   }
+
+   if ( !spf->gapCapNodes )
+      spf_spread_lists( spf );
+   if ( spf->endn[tail] == spf->limitn[tail] )
+      spf_move_list( spf, tail );
+
+   // keeping the list sorted by head
+   Neighbor *pos = spf->startn[tail];
+   while ( (pos<spf->endn[tail]) && (pos->node<head) )
+      ++pos;
+   const int k = pos - spf->neighs;
+   const int nMove = spf->endn[tail] - pos;
+   memmove( pos+1, pos, sizeof(Neighbor)*nMove );
+   pos->node     = head;
+   pos->distance = cost;
+   if ( spf->layout == SPF_LAYOUT_SOA )
+   {
+      memmove( spf->head+k+1, spf->head+k, sizeof(int)*nMove );
+      memmove( spf->weight+k+1, spf->weight+k, sizeof(int)*nMove );
+      spf->head[k]   = head;
+      spf->weight[k] = cost;
+   }
+   ++spf->endn[tail];
+   ++spf->arcs;
+
+   // positions of arcs changed
+   spf->rValid  = 0;
+   spf->jValid  = 0;
+   spf->lmValid = 0;
+   spf->delta   = 0;
+   spf->nkPaths = 0;
+   if ( spf->denseValid )
+      spf->denseW[((size_t)tail)*spf->nodes+head] = cost;
+
+   // works as a decrease from infinity
+   if ( (spf->dynamic) && (spf->treeOrigin!=NULL_NODE) )
+      spf_repair_tree( spf, tail, head, SP_INFTY_DIST, cost );
+}
+
+void spf_delete_arc( ShortestPathsFinder* spf, const int _tail, const int _head )
+{
+   spf_check_mutable( spf, "spf_delete_arc" );
+   spf_check_flat( spf, "spf_delete_arc" );
+   const int tail = NODE_IN( spf, _tail );
+   const int head = NODE_IN( spf, _head );
+
+   if ( !spf_find_arc( spf, tail, head ) )
+   {
+      fprintf( stderr, "Error: arc (%d,%d) does not exist.\n", _tail, _head );
+      exit( EXIT_FAILURE );
+   }
+
+   if ( spf_arc( spf, tail, head )->distance == SP_INFTY_DIST )
+   {
+      // temporarily removed arc: it will not be restored
+      for ( int i=spf->nRemoved-1 ; (i>=0) ; --i )
+      {
+         if ( (spf->removed[i].tail==tail) && (spf->removed[i].head==head) )
+         {
+            spf->removed[i] = spf->removed[spf->nRemoved-1];
+            --spf->nRemoved;
+            break;
+         }
+      }
+   }
+   else
+   {
+      // as an increase to infinity, so that the dense
+      // matrix and the tree in dynamic mode are updated
+      arc_update( spf, tail, head, SP_INFTY_DIST );
+   }
+
+   if ( !spf->gapCapNodes )
+      spf_spread_lists( spf );
+
+   Neighbor *arc = spf_arc( spf, tail, head );
+   const int k = arc - spf->neighs;
+   const int nMove = spf->endn[tail] - arc - 1;
+   memmove( arc, arc+1, sizeof(Neighbor)*nMove );
+   if ( spf->layout == SPF_LAYOUT_SOA )
+   {
+      memmove( spf->head+k, spf->head+k+1, sizeof(int)*nMove );
+      memmove( spf->weight+k, spf->weight+k+1, sizeof(int)*nMove );
+   }
+   --spf->endn[tail];
+   --spf->arcs;
+
+   spf->rValid  = 0;
+   spf->jValid  = 0;
+   spf->lmValid = 0;
+   spf->delta   = 0;
+   spf->nkPaths = 0;
+}
+
+void spf_compact( ShortestPathsFinder* spf )
+{
+   spf_check_mutable( spf, "spf_compact" );
+   spf_check_flat( spf, "spf_compact" );
+   if ( !spf->gapCapNodes )
+      return;
+
+   const int nodes = spf->nodes;
+   spf->caparcs = spf->arcs ? spf->arcs : 1;
+   Neighbor *neighs = (Neighbor*) xmalloc( sizeof(Neighbor)*spf->caparcs );
+   Neighbor *pn = neighs;
+   for ( int u=0 ; (u<nodes) ; ++u )
+   {
+      const int deg = spf->endn[u] - spf->startn[u];
+      memcpy( pn, spf->startn[u], sizeof(Neighbor)*deg );
+      spf->startn[u] = pn;
+      pn += deg;
+   }
+   spf->startn[nodes] = pn;
+
+   free( spf->neighs );
+   spf->neighs = neighs;
+   spf_reset_gaps( spf );
+
+   spf->rValid = 0;
+   spf->jValid = 0;
+   spf_sync_layout( spf );
+}
+
+int spf_used_arcs( const ShortestPathsFinder* spf )
+{
+   return spf->nUsedArcs;
+}
+
+static void spf_reset_gaps( ShortestPathsFinder* spf )
+{
+   if ( spf->gapCapNodes )
+   {
+      free( spf->endn );
+      free( spf->limitn );
+      spf->gapCapNodes = 0;
+      spf->limitn      = NULL;
+   }
+
+   spf->endn = spf->startn ? spf->startn+1 : NULL;
+   spf->nUsedArcs = spf->nodes ? spf->startn[spf->nodes] - spf->neighs : 0;
+}
+
+static void spf_spread_lists( ShortestPathsFinder* spf )
+{
+   const int nodes = spf->nodes;
+
+   int total = 0;
+   for ( int u=0 ; (u<nodes) ; ++u )
+   {
+      const int deg = spf->endn[u] - spf->startn[u];
+      total += deg + SPF_GAP_MIN + deg/SPF_GAP_DIV;
+   }
+   // lists that run out of free slots are moved to the end
+   const int capArcs = total + total/2;
+
+   Neighbor *neighs  = (Neighbor*) xmalloc( sizeof(Neighbor)*capArcs );
+   Neighbor **startn = (Neighbor**) xmalloc( sizeof(Neighbor*)*(spf->capnodes+1) );
+   Neighbor **endn   = (Neighbor**) xmalloc( sizeof(Neighbor*)*spf->capnodes );
+   Neighbor **limitn = (Neighbor**) xmalloc( sizeof(Neighbor*)*spf->capnodes );
+   Neighbor *pn = neighs;
+   for ( int u=0 ; (u<nodes) ; ++u )
+   {
+      const int deg = spf->endn[u] - spf->startn[u];
+      memcpy( pn, spf->startn[u], sizeof(Neighbor)*deg );
+      startn[u] = pn;
+      endn[u]   = pn + deg;
+      pn += deg + SPF_GAP_MIN + deg/SPF_GAP_DIV;
+      limitn[u] = pn;
+   }
+   startn[nodes] = pn;
+
+   if ( spf->gapCapNodes )
+   {
+      free( spf->endn );
+      free( spf->limitn );
+   }
+   free( spf->neighs );
+   free( spf->startn );
+   spf->neighs      = neighs;
+   spf->startn      = startn;
+   spf->endn        = endn;
+   spf->limitn      = limitn;
+   spf->gapCapNodes = spf->capnodes;
+   spf->caparcs     = capArcs;
+   spf->nUsedArcs   = pn - neighs;
+
+   spf->rValid = 0;
+   spf->jValid = 0;
+   spf_sync_layout( spf );
+}
+
+static void spf_move_list( ShortestPathsFinder* spf, const int node )
+{
+   const int deg = spf->endn[node] - spf->startn[node];
+   const int cap = 2*deg + SPF_GAP_MIN;
+   if ( spf->nUsedArcs + cap > spf->caparcs )
+   {
+      // no space left at the end, all lists get free slots
+      spf_spread_lists( spf );
+      return;
+   }
+
+   const int from = spf->startn[node] - spf->neighs;
+   const int to   = spf->nUsedArcs;
+   memcpy( spf->neighs+to, spf->neighs+from, sizeof(Neighbor)*deg );
+   if ( spf->layout == SPF_LAYOUT_SOA )
+   {
+      memcpy( spf->head+to, spf->head+from, sizeof(int)*deg );
+      memcpy( spf->weight+to, spf->weight+from, sizeof(int)*deg );
+   }
+   spf->startn[node] = spf->neighs + to;
+   spf->endn[node]   = spf->neighs + to + deg;
+   spf->limitn[node] = spf->neighs + to + cap;
+   spf->nUsedArcs += cap;
+}
+
+void spf_set_dynamic( ShortestPathsFinder* spf, const char dynamic )
+{
+   if ( dynamic )
+      spf_check_flat( spf, "spf_set_dynamic" );
+   spf->dynamic = dynamic;
+}
+
+static void spf_invalidate_tree( ShortestPathsFinder* spf )
+{
+   spf->treeOrigin = NULL_NODE;
+   spf->rValid     = 0;
+   spf->nRemoved   = 0;
+   spf->localValid = 0;
+   spf->nkPaths    = 0;
+   spf->delta      = 0;
+   spf->denseValid = 0;
+   spf->jValid     = 0;
+   spf->lmValid    = 0;
+}
+
+static void allocateDynSpace( ShortestPathsFinder* spf )
+{
+   if ( ( spf->nodes > spf->dynCapNodes ) || ( spf->arcs > spf->dynCapArcs ) )
+   {
+      freeDynSpace( spf );
+
+      spf->dynCapNodes = spf->capnodes;
+      spf->dynCapArcs  = spf->caparcs;
+
+      spf->rstart     = (int*) xmalloc( sizeof(int)*(spf->dynCapNodes+1) );
+      spf->rtail      = (int*) xmalloc( sizeof(int)*spf->dynCapArcs );
+      spf->rarc       = (int*) xmalloc( sizeof(int)*spf->dynCapArcs );
+      spf->queue      = (int*) xmalloc( sizeof(int)*spf->dynCapNodes );
+      spf->ivAffected = (char*) xmalloc( sizeof(char)*spf->dynCapNodes );
+      spf->rValid     = 0;
+   }
+
+   if ( spf->rValid )
+      return;
+
+   const int nodes = spf->nodes;
+
+   // counting arcs entering each node
+   int *rstart = spf->rstart;
+   memset( rstart, 0, sizeof(int)*(nodes+1) );
+   for ( int u=0 ; (u<nodes) ; ++u )
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+         ++rstart[n->node+1];
+   for ( int i=1 ; (i<=nodes) ; ++i )
+      rstart[i] += rstart[i-1];
+
+   // filling, queue is used as insertion position
+   int *pos = spf->queue;
+   memcpy( pos, rstart, sizeof(int)*nodes );
+   for ( int u=0 ; (u<nodes) ; ++u )
+   {
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+      {
+         const int p = pos[n->node]++;
+         spf->rtail[p] = u;
+         spf->rarc[p]  = n - spf->neighs;
+      }
+   }
+
+   memset( spf->ivAffected, 0, sizeof(char)*nodes );
+   spf->rValid = 1;
+}
+
+static void freeDynSpace( ShortestPathsFinder* spf )
+{
+   if ( spf->dynCapNodes )
+   {
+      spf->dynCapNodes = 0;
+      spf->dynCapArcs  = 0;
+      spf->rValid      = 0;
+      free( spf->rstart );
+      free( spf->rtail );
+      free( spf->rarc );
+      free( spf->queue );
+      free( spf->ivAffected );
+   }
+}
+
+static void spf_repair_tree( ShortestPathsFinder* spf, const int tail, const int head, const int oldCost, const int newCost )
+{
+   int *dist     = spf->dist;
+   int *previous = spf->previous;
+
+   if ( newCost < oldCost )
+   {
+      // decrease: improvements propagate from head
+      if ( (dist[tail]==SP_INFTY_DIST) || (dist[tail]+newCost>=dist[head]) )
+         return;
+      dist[head]     = dist[tail]+newCost;
+      previous[head] = tail;
+      npq_update( spf->npq, head, dist[head] );
+      spf_propagate( spf );
+      return;
+   }
+
+   // increase: only the subtree rooted
+   // at head, if the arc is in the tree
+   if ( previous[head] != tail )
+      return;
+
+   allocateDynSpace( spf );
+
+   // collecting the affected subtree
+   int *queue = spf->queue;
+   char *ivAffected = spf->ivAffected;
+   int nAffected = 0;
+   queue[nAffected++] = head;
+   ivAffected[head] = 1;
+   for ( int i=0 ; (i<nAffected) ; ++i )
+   {
+      const int u = queue[i];
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+      {
+         const int v = n->node;
+         if ( (previous[v]==u) && (!ivAffected[v]) )
+         {
+            ivAffected[v] = 1;
+            queue[nAffected++] = v;
+         }
+      }
+   }
+
+   for ( int i=0 ; (i<nAffected) ; ++i )
+   {
+      dist[queue[i]]     = SP_INFTY_DIST;
+      previous[queue[i]] = NULL_NODE;
+   }
+
+   // best distance for each affected node
+   // coming from an unaffected one
+   for ( int i=0 ; (i<nAffected) ; ++i )
+   {
+      const int v = queue[i];
+      for ( int p=spf->rstart[v] ; (p<spf->rstart[v+1]) ; ++p )
+      {
+         const int u = spf->rtail[p];
+         if ( (ivAffected[u]) || (dist[u]==SP_INFTY_DIST) )
+            continue;
+         const int newDist = dist[u] + spf->neighs[spf->rarc[p]].distance;
+         if ( newDist < dist[v] )
+         {
+            dist[v]     = newDist;
+            previous[v] = u;
+         }
+      }
+      if ( dist[v] < SP_INFTY_DIST )
+         npq_update( spf->npq, v, dist[v] );
+   }
+
+   for ( int i=0 ; (i<nAffected) ; ++i )
+      ivAffected[queue[i]] = 0;
+
+   spf_propagate( spf );
 }
 
 void spf_update_graph( ShortestPathsFinder* spf, const int nodes, const int arcs, const int *arcStart, const int *toNode, const int *dist )
 {
+   spf_check_mutable( spf, "spf_update_graph" );
+   spf_invalidate_tree( spf );
+   freeOrderSpace( spf );
+   freeCompressedSpace( spf );
    spf->nodes = nodes;
    spf->arcs  = arcs;
 
-   if (nodes > spf->capnodes )
+   if ( (nodes > spf->capnodes) || (!spf->startn) )
    {
       if ( spf->startn )
          free( spf->startn );
@@ -785,8 +2350,15 @@ void spf_update_graph( ShortestPathsFinder* spf, const int nodes, const int arcs
          free( spf->previous );
       if ( spf->dist )
          free( spf->dist );
+      if ( spf->path )
+         free( spf->path );
       if ( spf->npq )
          npq_free( &(spf->npq) );
+      if ( spf->denseClosed )
+      {
+         free( spf->denseClosed );
+         spf->denseClosed = NULL;
+      }
 
       spf->capnodes = nodes;
       if (nodes<1024)
@@ -826,6 +2398,10 @@ void spf_update_graph( ShortestPathsFinder* spf, const int nodes, const int arcs
       ptrNeigh->node     = toNode[ idx ];
       ptrNeigh->distance = dist[ idx ];
    }
+
+   spf_reset_gaps( spf );
+   spf_apply_order( spf );
+   spf_sync_layout( spf );
 }
 
 int spf_fw_ran( ShortestPathsFinder* spf )
@@ -838,12 +2414,1465 @@ void freeFWSpace( ShortestPathsFinder* spf )
 {
    if ( spf->fwCapNodes )
    {
+      const size_t cells = ((size_t)spf->fwCapNodes)*spf->fwCapNodes;
       spf->fwCapNodes = 0;
       spf->fwCapArcs  = 0;
-      free ( spf->fwDist[0] );
+      bm_free( spf->fwDist[0], sizeof(int)*cells );
       free ( spf->fwDist );
-      free ( spf->fwPrev[0] );
+      bm_free( spf->fwPrev[0], sizeof(int)*cells );
       free ( spf->fwPrev );
+      spf->fwDist = NULL;
+      spf->fwPrev = NULL;
+   }
+}
+
+typedef struct
+{
+   int64_t key;
+   int node;
+} NodeKey;
+
+static int compNodeKeys( const void *p1, const void *p2 )
+{
+   const NodeKey *k1 = (const NodeKey *)p1;
+   const NodeKey *k2 = (const NodeKey *)p2;
+
+   if ( k1->key != k2->key )
+      return ( k1->key < k2->key ) ? -1 : 1;
+
+   return k1->node - k2->node;
+}
+
+void spf_set_node_order( ShortestPathsFinder* spf, const int method )
+{
+   spf_check_mutable( spf, "spf_set_node_order" );
+   spf->orderMethod = method;
+   if ( spf->nodes )
+   {
+      if ( spf->cCap )
+         spf_decompress( spf );
+      spf_apply_order( spf );
+      spf_sync_layout( spf );
+   }
+}
+
+void spf_set_coordinates( ShortestPathsFinder* spf, const int nodes, const double x[], const double y[] )
+{
+   if ( spf->coordX )
+   {
+      free( spf->coordX );
+      free( spf->coordY );
+   }
+
+   spf->nCoords = nodes;
+   spf->coordX  = (double*) xmalloc( sizeof(double)*nodes );
+   spf->coordY  = (double*) xmalloc( sizeof(double)*nodes );
+   memcpy( spf->coordX, x, sizeof(double)*nodes );
+   memcpy( spf->coordY, y, sizeof(double)*nodes );
+}
+
+static void freeOrderSpace( ShortestPathsFinder* spf )
+{
+   if ( spf->orderCapNodes )
+   {
+      spf->orderCapNodes = 0;
+      free( spf->perm );
+      free( spf->iperm );
+      free( spf->prevOut );
+      free( spf->settledOut );
+      spf->perm       = NULL;
+      spf->iperm      = NULL;
+      spf->prevOut    = NULL;
+      spf->settledOut = NULL;
+   }
+}
+
+static void spf_order_bfs( const ShortestPathsFinder* spf, int newId[], const char reverse )
+{
+   const int nodes = spf->nodes;
+   int *queue = (int*) xmalloc( sizeof(int)*nodes );
+   NodeKey *nk = (NodeKey*) xmalloc( sizeof(NodeKey)*nodes );
+
+   for ( int i=0 ; (i<nodes) ; ++i )
+      newId[i] = NULL_NODE;
+
+   // starting nodes: Cuthill-McKee starts
+   // at nodes with smallest degree
+   for ( int i=0 ; (i<nodes) ; ++i )
+   {
+      nk[i].key  = reverse ? spf->endn[i]-spf->startn[i] : 0;
+      nk[i].node = i;
+   }
+   if ( reverse )
+      qsort( nk, nodes, sizeof(NodeKey), compNodeKeys );
+
+   int nQueue = 0;
+   for ( int s=0 ; (s<nodes) ; ++s )
+   {
+      const int start = nk[s].node;
+      if ( newId[start] != NULL_NODE )
+         continue;
+
+      int first = nQueue;
+      newId[start] = nQueue;
+      queue[nQueue++] = start;
+      for ( ; (first<nQueue) ; ++first )
+      {
+         const int u = queue[first];
+         const int firstNeigh = nQueue;
+         for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+         {
+            if ( newId[n->node] != NULL_NODE )
+               continue;
+            newId[n->node] = nQueue;
+            queue[nQueue++] = n->node;
+         }
+
+         if ( !reverse )
+            continue;
+
+         // neighbors in increasing degree
+         for ( int i=firstNeigh+1 ; (i<nQueue) ; ++i )
+         {
+            const int v = queue[i];
+            const int degV = spf->endn[v]-spf->startn[v];
+            int j = i-1;
+            for ( ; (j>=firstNeigh) && (spf->endn[queue[j]]-spf->startn[queue[j]]>degV) ; --j )
+               queue[j+1] = queue[j];
+            queue[j+1] = v;
+         }
+         for ( int i=firstNeigh ; (i<nQueue) ; ++i )
+            newId[queue[i]] = i;
+      }
+   }
+
+   if ( reverse )
+      for ( int i=0 ; (i<nodes) ; ++i )
+         newId[i] = nodes-1-newId[i];
+
+   free( queue );
+   free( nk );
+}
+
+/* position of (x,y) in the Hilbert
+ * curve filling a n x n grid
+ */
+static int64_t hilbert_d( const uint32_t n, uint32_t x, uint32_t y )
+{
+   int64_t d = 0;
+   for ( uint32_t s=n/2 ; (s>0) ; s/=2 )
+   {
+      const uint32_t rx = (x & s) > 0;
+      const uint32_t ry = (y & s) > 0;
+      d += ((int64_t)s) * ((int64_t)s) * ((3 * rx) ^ ry);
+      if ( ry == 0 )
+      {
+         if ( rx == 1 )
+         {
+            x = n-1-x;
+            y = n-1-y;
+         }
+         const uint32_t t = x;
+         x = y;
+         y = t;
+      }
+   }
+
+   return d;
+}
+
+static void spf_order_hilbert( const ShortestPathsFinder* spf, int newId[] )
+{
+   const int nodes = spf->nodes;
+   const uint32_t gridSize = 1<<16;
+
+   double minX = spf->coordX[0], maxX = spf->coordX[0];
+   double minY = spf->coordY[0], maxY = spf->coordY[0];
+   for ( int i=1 ; (i<nodes) ; ++i )
+   {
+      minX = spf->coordX[i] < minX ? spf->coordX[i] : minX;
+      maxX = spf->coordX[i] > maxX ? spf->coordX[i] : maxX;
+      minY = spf->coordY[i] < minY ? spf->coordY[i] : minY;
+      maxY = spf->coordY[i] > maxY ? spf->coordY[i] : maxY;
+   }
+   const double scaleX = (maxX>minX) ? ((double)(gridSize-1))/(maxX-minX) : 0.0;
+   const double scaleY = (maxY>minY) ? ((double)(gridSize-1))/(maxY-minY) : 0.0;
+
+   NodeKey *nk = (NodeKey*) xmalloc( sizeof(NodeKey)*nodes );
+   for ( int i=0 ; (i<nodes) ; ++i )
+   {
+      // coordinates are indexed by original node
+      const int orig = NODE_OUT( spf, i );
+      const uint32_t x = (uint32_t) ((spf->coordX[orig]-minX)*scaleX);
+      const uint32_t y = (uint32_t) ((spf->coordY[orig]-minY)*scaleY);
+      nk[i].key  = hilbert_d( gridSize, x, y );
+      nk[i].node = i;
+   }
+   qsort( nk, nodes, sizeof(NodeKey), compNodeKeys );
+
+   for ( int i=0 ; (i<nodes) ; ++i )
+      newId[nk[i].node] = i;
+
+   free( nk );
+}
+
+static void spf_apply_order( ShortestPathsFinder* spf )
+{
+   const int nodes = spf->nodes;
+   if ( (spf->orderMethod==SPF_ORDER_NONE) && (!spf->perm) )
+      return;
+
+   int *newId = (int*) xmalloc( sizeof(int)*nodes*2 );
+   int *oldId = newId + nodes;
+
+   switch ( spf->orderMethod )
+   {
+   case SPF_ORDER_NONE:
+      // back to the original order
+      memcpy( newId, spf->iperm, sizeof(int)*nodes );
+      break;
+   case SPF_ORDER_BFS:
+      spf_order_bfs( spf, newId, 0 );
+      break;
+   case SPF_ORDER_HILBERT:
+      if ( spf->nCoords == nodes )
+      {
+         spf_order_hilbert( spf, newId );
+         break;
+      }
+      // fall through
+   case SPF_ORDER_RCM:
+      spf_order_bfs( spf, newId, 1 );
+      break;
+   default:
+      fprintf( stderr, "Error: invalid node order method %d.\n", spf->orderMethod );
+      exit( EXIT_FAILURE );
+   }
+
+   for ( int i=0 ; (i<nodes) ; ++i )
+      oldId[newId[i]] = i;
+
+   // permuting the graph, neighbors
+   // are sorted again by node
+   Neighbor *neighs  = (Neighbor*) xmalloc( sizeof(Neighbor)*spf->caparcs );
+   Neighbor **startn = (Neighbor**) xmalloc( sizeof(Neighbor*)*(spf->capnodes+1) );
+   Neighbor *pn = neighs;
+   for ( int v=0 ; (v<nodes) ; ++v )
+   {
+      const int u = oldId[v];
+      startn[v] = pn;
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n,++pn )
+      {
+         pn->node     = newId[n->node];
+         pn->distance = n->distance;
+      }
+      qsort( startn[v], pn-startn[v], sizeof(Neighbor), compNeighs );
+   }
+   startn[nodes] = pn;
+
+   free( spf->neighs );
+   free( spf->startn );
+   spf->neighs = neighs;
+   spf->startn = startn;
+   spf_reset_gaps( spf );
+
+   // removed arcs keep their original costs
+   for ( int i=0 ; (i<spf->nRemoved) ; ++i )
+   {
+      spf->removed[i].tail = newId[spf->removed[i].tail];
+      spf->removed[i].head = newId[spf->removed[i].head];
+   }
+   const int nRemoved = spf->nRemoved;
+   spf_invalidate_tree( spf );
+   spf->nRemoved = nRemoved;
+   freeFWSpace( spf );
+
+   if ( spf->orderMethod == SPF_ORDER_NONE )
+      freeOrderSpace( spf );
+   else
+   {
+      if ( !spf->perm )
+      {
+         spf->orderCapNodes = spf->capnodes;
+         spf->perm       = (int*) xmalloc( sizeof(int)*spf->orderCapNodes );
+         spf->iperm      = (int*) xmalloc( sizeof(int)*spf->orderCapNodes );
+         spf->prevOut    = (int*) xmalloc( sizeof(int)*spf->orderCapNodes );
+         spf->settledOut = (int*) xmalloc( sizeof(int)*spf->orderCapNodes );
+         memcpy( spf->perm, newId, sizeof(int)*nodes );
+      }
+      else
+      {
+         for ( int i=0 ; (i<nodes) ; ++i )
+            spf->perm[i] = newId[spf->perm[i]];
+      }
+      for ( int i=0 ; (i<nodes) ; ++i )
+         spf->iperm[spf->perm[i]] = i;
+   }
+
+   free( newId );
+}
+
+static void spf_reset_local( ShortestPathsFinder* spf )
+{
+   if ( spf->nodes > spf->localCapNodes )
+   {
+      if ( spf->settled )
+      {
+         free( spf->settled );
+         free( spf->source );
+         free( spf->isTarget );
+         free( spf->spurSkip );
+      }
+      spf->localCapNodes = spf->capnodes;
+      spf->settled  = (int*) xmalloc( sizeof(int)*spf->localCapNodes );
+      spf->source   = (int*) xmalloc( sizeof(int)*spf->localCapNodes );
+      spf->isTarget = (char*) xmalloc( sizeof(char)*spf->localCapNodes );
+      memset( spf->isTarget, 0, sizeof(char)*spf->localCapNodes );
+      spf->spurSkip = (char*) xmalloc( sizeof(char)*spf->localCapNodes );
+      memset( spf->spurSkip, 0, sizeof(char)*spf->localCapNodes );
+      spf->localValid = 0;
+   }
+
+   if ( spf->localValid )
+   {
+      for ( int i=0 ; (i<spf->nSettled) ; ++i )
+      {
+         spf->dist[spf->settled[i]]     = SP_INFTY_DIST;
+         spf->previous[spf->settled[i]] = NULL_NODE;
+      }
+   }
+   else
+   {
+      for ( int i=0 ; (i<spf->nodes) ; i++ )
+         spf->dist[i] = SP_INFTY_DIST;
+      for ( int i=0 ; (i<spf->nodes) ; i++ )
+         spf->previous[i] = NULL_NODE;
+   }
+
+   spf->nSettled   = 0;
+   spf->localValid = 1;
+   // dist is not a complete tree anymore
+   spf->treeOrigin = NULL_NODE;
+}
+
+static void spf_find_local( ShortestPathsFinder* spf, const int origins[], const int nOrigins,
+      const int maxDist, const int dest, const char *blocked )
+{
+   NodePQueuePtr npq = spf->npq;
+   int *dist = spf->dist;
+   int *previous = spf->previous;
+
+   spf_reset_local( spf );
+   int *settled = spf->settled;
+   int *source  = spf->source;
+   SPF_COUNT( spf, searches, 1 );
+
+   for ( int i=0 ; (i<nOrigins) ; ++i )
+   {
+      const int origin = origins[i];
+      if ( dist[origin] == 0 )   // repeated
+         continue;
+      dist[origin]   = 0;
+      source[origin] = origin;
+      npq_update( npq, origin, 0 );
+      SPF_COUNT( spf, heapPushes, 1 );
+   }
+
+   int topCost, topNode;
+   while ( (topCost=npq_remove_first( npq, &topNode )) < SP_INFTY_DIST )
+   {
+      if ( topCost > maxDist )
+      {
+         dist[topNode]     = SP_INFTY_DIST;
+         previous[topNode] = NULL_NODE;
+         break;
+      }
+
+      settled[spf->nSettled++] = topNode;
+      SPF_COUNT( spf, settled, 1 );
+      if ( topNode == dest )
+         break;
+      if ( (spf->nTargetsLeft) && (spf->isTarget[topNode]) && (--spf->nTargetsLeft==0) )
+         break;
+
+      const int src  = source[topNode];
+      if ( spf->layout == SPF_LAYOUT_COMPRESSED )
+      {
+         const unsigned char *p   = spf->cData + spf->cStart[topNode];
+         const unsigned char *end = spf->cData + spf->cStart[topNode+1];
+         int toNode = topNode;
+         while ( p<end )
+         {
+            toNode += spf_unzigzag( spf_get_varint( &p ) );
+            const int newDist = topCost + spf_unzigzag( spf_get_varint( &p ) );
+            SPF_COUNT( spf, relaxations, 1 );
+            if ( dist[ toNode ] > newDist )
+            {
+               if ( (blocked) && (blocked[toNode]) )
+                  continue;
+               if ( (topNode==spf->spurNode) && (spf->spurSkip[toNode]) )
+                  continue;
+               SPF_COUNT_UPDATE( spf, dist[toNode] );
+               previous[ toNode ] = topNode;
+               dist[ toNode ]     = newDist;
+               source[ toNode ]   = src;
+               npq_update( npq, toNode, newDist );
+            }
+         }
+         continue;
+      }
+
+      Neighbor *n    = spf->startn[topNode];
+      Neighbor *endN = spf->endn[topNode];
+      SPF_COUNT( spf, relaxations, endN-n );
+      for ( ; (n<endN) ; n++ )
+      {
+         const int toNode  = n->node;
+         const int newDist = topCost + n->distance;
+         if ( dist[ toNode ] > newDist )
+         {
+            if ( (blocked) && (blocked[toNode]) )
+               continue;
+            if ( (topNode==spf->spurNode) && (spf->spurSkip[toNode]) )
+               continue;
+            SPF_COUNT_UPDATE( spf, dist[toNode] );
+            previous[ toNode ] = topNode;
+            dist[ toNode ]     = newDist;
+            source[ toNode ]   = src;
+            npq_update( npq, toNode, newDist );
+         }
+      }
+   }
+
+   // emptying the priority queue, nodes
+   // not settled go back to infinity
+   while ( npq_remove_first( npq, &topNode ) < SP_INFTY_DIST )
+   {
+      dist[topNode]     = SP_INFTY_DIST;
+      previous[topNode] = NULL_NODE;
+   }
+}
+
+void spf_find_multi( ShortestPathsFinder* spf, const int origins[], const int nOrigins )
+{
+   spf_find_multi_radius( spf, origins, nOrigins, SP_INFTY_DIST );
+}
+
+void spf_find_radius( ShortestPathsFinder* spf, const int origin, const int maxDist )
+{
+   spf_find_multi_radius( spf, &origin, 1, maxDist );
+}
+
+void spf_find_multi_radius( ShortestPathsFinder* spf, const int origins[], const int nOrigins, const int maxDist )
+{
+   if ( !spf->perm )
+   {
+      spf_find_local( spf, origins, nOrigins, maxDist, NULL_NODE, NULL );
+      return;
+   }
+
+   int *iorigins = (int*) xmalloc( sizeof(int)*nOrigins );
+   for ( int i=0 ; (i<nOrigins) ; ++i )
+      iorigins[i] = spf->perm[origins[i]];
+   spf_find_local( spf, iorigins, nOrigins, maxDist, NULL_NODE, NULL );
+   free( iorigins );
+
+   for ( int i=0 ; (i<spf->nSettled) ; ++i )
+      spf->settledOut[i] = spf->iperm[spf->settled[i]];
+}
+
+void spf_set_landmarks( ShortestPathsFinder* spf, const int nLandmarks )
+{
+   spf_check_mutable( spf, "spf_set_landmarks" );
+   if ( nLandmarks>0 )
+      spf_check_flat( spf, "spf_set_landmarks" );
+
+   spf->nLandmarks = nLandmarks>0 ? nLandmarks : 0;
+   spf->lmValid = 0;
+   if ( (spf->nLandmarks) && (spf->nodes) )
+      spf_compute_landmarks( spf );
+}
+
+static ShortestPathsFinder *spf_copy_graph( const ShortestPathsFinder* spf, const char reverse )
+{
+   const int nodes = spf->nodes;
+   const int arcs = spf->arcs;
+   int *start = (int*) xmalloc( sizeof(int)*(nodes+1) );
+   int *to    = (int*) xmalloc( sizeof(int)*(arcs+1) );
+   int *dist  = (int*) xmalloc( sizeof(int)*(arcs+1) );
+   memset( start, 0, sizeof(int)*(nodes+1) );
+   for ( int u=0 ; (u<nodes) ; ++u )
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+         ++start[(reverse ? n->node : u)+1];
+   for ( int i=0 ; (i<nodes) ; ++i )
+      start[i+1] += start[i];
+   int *pos = (int*) xmalloc( sizeof(int)*nodes );
+   memcpy( pos, start, sizeof(int)*nodes );
+   for ( int u=0 ; (u<nodes) ; ++u )
+   {
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+      {
+         const int tail = reverse ? n->node : u;
+         to[pos[tail]]   = reverse ? u : n->node;
+         dist[pos[tail]] = n->distance;
+         ++pos[tail];
+      }
+   }
+
+   ShortestPathsFinder *result = spf_create();
+   spf_update_graph( result, nodes, arcs, start, to, dist );
+   free( pos );
+   free( start );
+   free( to );
+   free( dist );
+
+   return result;
+}
+
+static void spf_compute_landmarks( ShortestPathsFinder* spf )
+{
+   const int nodes = spf->nodes;
+   const int nl = spf->nLandmarks < nodes ? spf->nLandmarks : nodes;
+   const size_t required = ((size_t)nodes)*nl;
+
+   if ( spf->lmCap < required )
+   {
+      if ( spf->lmCap )
+      {
+         free( spf->lmFrom );
+         free( spf->lmTo );
+      }
+      spf->lmCap  = required;
+      spf->lmFrom = (int*) xmalloc( sizeof(int)*required );
+      spf->lmTo   = (int*) xmalloc( sizeof(int)*required );
+   }
+
+   ShortestPathsFinder *fwd = spf_copy_graph( spf, 0 );
+   ShortestPathsFinder *rev = spf_copy_graph( spf, 1 );
+
+   // farthest selection: the next landmark is the node whose
+   // nearest landmark is the farthest (unreachable first)
+   int *minDist = (int*) xmalloc( sizeof(int)*nodes );
+   for ( int i=0 ; (i<nodes) ; ++i )
+      minDist[i] = INT_MAX;
+   spf_find( fwd, 0 );
+   int landmark = 0;
+   for ( int i=0 ; (i<nodes) ; ++i )
+      if ( (fwd->dist[i]<SP_INFTY_DIST) && (fwd->dist[i]>fwd->dist[landmark]) )
+         landmark = i;
+
+   for ( int l=0 ; (l<nl) ; ++l )
+   {
+      spf_find( fwd, landmark );
+      spf_find( rev, landmark );
+      for ( int i=0 ; (i<nodes) ; ++i )
+      {
+         spf->lmFrom[((size_t)i)*nl+l] = fwd->dist[i];
+         spf->lmTo[((size_t)i)*nl+l]   = rev->dist[i];
+         if ( fwd->dist[i] < minDist[i] )
+            minDist[i] = fwd->dist[i];
+      }
+
+      landmark = 0;
+      for ( int i=1 ; (i<nodes) ; ++i )
+         if ( minDist[i] > minDist[landmark] )
+            landmark = i;
+   }
+
+   free( minDist );
+   spf_free( &fwd );
+   spf_free( &rev );
+
+   spf->nLandmarks = nl;
+   spf->lmValid = 1;
+}
+
+/* lower bound on the distance from v to t */
+static inline int spf_lm_bound( const ShortestPathsFinder* spf, const int v, const int t )
+{
+   const int nl = spf->nLandmarks;
+   const int *fromV = spf->lmFrom + ((size_t)v)*nl;
+   const int *fromT = spf->lmFrom + ((size_t)t)*nl;
+   const int *toV   = spf->lmTo + ((size_t)v)*nl;
+   const int *toT   = spf->lmTo + ((size_t)t)*nl;
+
+   int result = 0;
+   for ( int l=0 ; (l<nl) ; ++l )
+   {
+      if ( (fromT[l]<SP_INFTY_DIST) && (fromV[l]<SP_INFTY_DIST) && (fromT[l]-fromV[l]>result) )
+         result = fromT[l]-fromV[l];
+      if ( (toV[l]<SP_INFTY_DIST) && (toT[l]<SP_INFTY_DIST) && (toV[l]-toT[l]>result) )
+         result = toV[l]-toT[l];
+   }
+
+   return result;
+}
+
+int spf_find_to( ShortestPathsFinder* spf, const int _origin, const int _dest )
+{
+   const int origin = NODE_IN( spf, _origin );
+   const int dest   = NODE_IN( spf, _dest );
+
+   // the compressed layout has no landmarks
+   if ( (!spf->nLandmarks) || (spf->layout==SPF_LAYOUT_COMPRESSED) )
+   {
+      spf_find_local( spf, &origin, 1, SP_INFTY_DIST, dest, NULL );
+      return spf->dist[dest];
+   }
+
+   if ( !spf->lmValid )
+   {
+      spf_check_mutable( spf, "spf_find_to (landmarks outdated)" );
+      spf_compute_landmarks( spf );
+   }
+
+   // A* search, keys in the heap are
+   // distances plus lower bounds
+   NodePQueuePtr npq = spf->npq;
+   int *dist = spf->dist;
+   int *previous = spf->previous;
+
+   spf_reset_local( spf );
+   int *settled = spf->settled;
+
+   dist[origin] = 0;
+   npq_update( npq, origin, spf_lm_bound( spf, origin, dest ) );
+   SPF_COUNT( spf, searches, 1 );
+   SPF_COUNT( spf, heapPushes, 1 );
+
+   int topKey, topNode;
+   while ( (topKey=npq_remove_first( npq, &topNode )) < SP_INFTY_DIST )
+   {
+      settled[spf->nSettled++] = topNode;
+      SPF_COUNT( spf, settled, 1 );
+      if ( topNode == dest )
+         break;
+
+      const int topCost = dist[topNode];
+      const Neighbor *n    = spf->startn[topNode];
+      const Neighbor *endN = spf->endn[topNode];
+      SPF_COUNT( spf, relaxations, endN-n );
+      for ( ; (n<endN) ; n++ )
+      {
+         const int toNode  = n->node;
+         const int newDist = topCost + n->distance;
+         if ( dist[ toNode ] > newDist )
+         {
+            SPF_COUNT_UPDATE( spf, dist[toNode] );
+            previous[ toNode ] = topNode;
+            dist[ toNode ]     = newDist;
+            const int key = newDist + spf_lm_bound( spf, toNode, dest );
+            npq_update( npq, toNode, key < SP_INFTY_DIST ? key : SP_INFTY_DIST-1 );
+         }
+      }
+   }
+
+   // nodes not settled go back to infinity
+   while ( npq_remove_first( npq, &topNode ) < SP_INFTY_DIST )
+   {
+      dist[topNode]     = SP_INFTY_DIST;
+      previous[topNode] = NULL_NODE;
+   }
+
+   if ( spf->perm )
+      for ( int i=0 ; (i<spf->nSettled) ; ++i )
+         spf->settledOut[i] = spf->iperm[spf->settled[i]];
+
+   return dist[dest];
+}
+
+void spf_find_targets( ShortestPathsFinder* spf, const int origin, const int targets[], const int k,
+      int outDist[], int outPrev[] )
+{
+   // allocates isTarget
+   spf_reset_local( spf );
+
+   spf->nTargetsLeft = 0;
+   for ( int i=0 ; (i<k) ; ++i )
+   {
+      const int t = NODE_IN( spf, targets[i] );
+      if ( spf->isTarget[t] )   // repeated
+         continue;
+      spf->isTarget[t] = 1;
+      ++spf->nTargetsLeft;
+   }
+
+   const int iorigin = NODE_IN( spf, origin );
+   spf_find_local( spf, &iorigin, 1, SP_INFTY_DIST, NULL_NODE, NULL );
+   spf->nTargetsLeft = 0;
+
+   for ( int i=0 ; (i<k) ; ++i )
+   {
+      const int t = NODE_IN( spf, targets[i] );
+      spf->isTarget[t] = 0;
+      outDist[i] = spf->dist[t];
+      if ( outPrev )
+         outPrev[i] = NODE_OUT( spf, spf->previous[t] );
+   }
+
+   if ( spf->perm )
+      for ( int i=0 ; (i<spf->nSettled) ; ++i )
+         spf->settledOut[i] = spf->iperm[spf->settled[i]];
+}
+
+int spf_n_settled( const ShortestPathsFinder *spf )
+{
+   return spf->nSettled;
+}
+
+const int *spf_settled( const ShortestPathsFinder *spf )
+{
+   return spf->perm ? spf->settledOut : spf->settled;
+}
+
+int spf_get_source( const ShortestPathsFinder *spf, const int _node )
+{
+   assert( _node < spf->nodes );
+   const int node = NODE_IN( spf, _node );
+   if ( spf->dist[node] == SP_INFTY_DIST )
+      return NULL_NODE;
+   return NODE_OUT( spf, spf->source[node] );
+}
+
+/* stores the path that arrives at dest after a local
+ * search, nodes from 0 to idx-1 come from path src,
+ * returns the index of the new path
+ */
+static int spf_store_k_path( ShortestPathsFinder* spf, int *nPaths, int **start, int **nodes, int **cum,
+      int **dev, int *capPaths, int *capNodes, const int src, const int idx, const int dest )
+{
+   const int np = *nPaths;
+   if ( np+2 > *capPaths )
+   {
+      int cap = *capPaths;
+      ADJUST_INT_VECTOR_CAPACITY( *start, cap, np+2 );
+      cap = *capPaths;
+      ADJUST_INT_VECTOR_CAPACITY( *dev, cap, np+2 );
+      *capPaths = cap;
+   }
+   if ( np == 0 )
+      (*start)[0] = 0;
+
+   // root part
+   const int rootDist = (src>=0) ? spf->kpCum[spf->kpStart[src]+idx] : 0;
+   int nSpur = 1;
+   for ( int v=dest ; (spf->previous[v]!=NULL_NODE) ; v=spf->previous[v] )
+      ++nSpur;
+   const int required = (*start)[np] + idx + nSpur;
+   if ( required > *capNodes )
+   {
+      int cap = *capNodes;
+      ADJUST_INT_VECTOR_CAPACITY( *nodes, cap, required );
+      cap = *capNodes;
+      ADJUST_INT_VECTOR_CAPACITY( *cum, cap, required );
+      *capNodes = cap;
+   }
+
+   int pos = (*start)[np];
+   for ( int i=0 ; (i<idx) ; ++i,++pos )
+   {
+      (*nodes)[pos] = spf->kpNodes[spf->kpStart[src]+i];
+      (*cum)[pos]   = spf->kpCum[spf->kpStart[src]+i];
+   }
+   // spur part
+   spf_path( spf, dest, (*nodes)+pos );
+   for ( int i=0 ; (i<nSpur) ; ++i,++pos )
+      (*cum)[pos] = rootDist + spf->dist[(*nodes)[pos]];
+
+   (*start)[np+1] = pos;
+   (*dev)[np]     = idx;
+   ++(*nPaths);
+
+   return np;
+}
+
+int spf_find_k_paths( ShortestPathsFinder* spf, const int _origin, const int _dest, const int k )
+{
+   const int origin = NODE_IN( spf, _origin );
+   const int dest   = NODE_IN( spf, _dest );
+
+   spf->nkPaths = 0;
+   if ( k<=0 )
+      return 0;
+
+   assert( origin!=dest );
+
+   spf_find_local( spf, &origin, 1, SP_INFTY_DIST, dest, NULL );
+   if ( spf->dist[dest] == SP_INFTY_DIST )
+      return 0;
+
+   spf_store_k_path( spf, &spf->nkPaths, &spf->kpStart, &spf->kpNodes, &spf->kpCum, &spf->kpDev,
+         &spf->capkPaths, &spf->capkpNodes, -1, 0, dest );
+
+   // candidates
+   int nCand = 0, capCand = 0, capCandNodes = 0, capSrc = 0;
+   int *cStart = NULL, *cNodes = NULL, *cCum = NULL, *cDev = NULL;
+   int *cSrc = NULL;
+
+   char *blocked = (char*) xmalloc( sizeof(char)*spf->nodes );
+   memset( blocked, 0, sizeof(char)*spf->nodes );
+   // paths whose root is the same as the current one
+   char *sameRoot = (char*) xmalloc( sizeof(char)*k );
+   // arcs ignored for one spur node
+   int *remHead = (int*) xmalloc( sizeof(int)*k );
+
+   while ( spf->nkPaths < k )
+   {
+      const int ip   = spf->nkPaths-1;
+      const int *p   = spf->kpNodes + spf->kpStart[ip];
+      const int lenP = spf->kpStart[ip+1] - spf->kpStart[ip];
+      const int devP = spf->kpDev[ip];
+
+      for ( int j=0 ; (j<spf->nkPaths) ; ++j )
+         sameRoot[j] = 1;
+
+      // root nodes up to the deviation index were
+      // already explored when the parent path was
+      // processed, only the root is blocked
+      for ( int i=0 ; (i<lenP-1) ; ++i )
+      {
+         // updating the paths sharing root p[0...i]
+         for ( int j=0 ; (j<spf->nkPaths) ; ++j )
+         {
+            if ( !sameRoot[j] )
+               continue;
+            const int lenQ = spf->kpStart[j+1] - spf->kpStart[j];
+            sameRoot[j] = ( (i<lenQ) && (spf->kpNodes[spf->kpStart[j]+i]==p[i]) );
+         }
+
+         if ( i >= devP )
+         {
+            const int spur = p[i];
+
+            // ignoring next arcs of paths with the same root,
+            // the graph is not changed so that query
+            // contexts can also search
+            int nRem = 0;
+            for ( int j=0 ; (j<spf->nkPaths) ; ++j )
+            {
+               const int lenQ = spf->kpStart[j+1] - spf->kpStart[j];
+               if ( (!sameRoot[j]) || (i+1>=lenQ) )
+                  continue;
+               const int next = spf->kpNodes[spf->kpStart[j]+i+1];
+               if ( spf->spurSkip[next] )
+                  continue;
+               spf->spurSkip[next] = 1;
+               remHead[nRem] = next;
+               ++nRem;
+            }
+
+            spf->spurNode = spur;
+            spf_find_local( spf, &spur, 1, SP_INFTY_DIST, dest, blocked );
+            spf->spurNode = NULL_NODE;
+
+            if ( spf->dist[dest] < SP_INFTY_DIST )
+            {
+               const int ic = spf_store_k_path( spf, &nCand, &cStart, &cNodes, &cCum, &cDev,
+                     &capCand, &capCandNodes, ip, i, dest );
+               ADJUST_INT_VECTOR_CAPACITY( cSrc, capSrc, nCand );
+
+               // discarding duplicates
+               const int len = cStart[ic+1]-cStart[ic];
+               for ( int c=0 ; (c<ic) ; ++c )
+               {
+                  if ( (cSrc[c]==-2) || (cStart[c+1]-cStart[c]!=len) )
+                     continue;
+                  if ( cCum[cStart[c+1]-1] != cCum[cStart[ic+1]-1] )
+                     continue;
+                  if ( memcmp( cNodes+cStart[c], cNodes+cStart[ic], sizeof(int)*len )==0 )
+                  {
+                     --nCand;
+                     break;
+                  }
+               }
+               if ( nCand > ic )
+                  cSrc[ic] = ip;
+            }
+
+            for ( int r=0 ; (r<nRem) ; ++r )
+               spf->spurSkip[remHead[r]] = 0;
+         }
+
+         blocked[p[i]] = 1;
+      } // spur nodes
+
+      for ( int i=0 ; (i<lenP) ; ++i )
+         blocked[p[i]] = 0;
+
+      // best candidate: shortest, then with fewer nodes
+      int best = -1;
+      for ( int c=0 ; (c<nCand) ; ++c )
+      {
+         if ( cSrc[c] == -2 )
+            continue;
+         if ( best == -1 )
+         {
+            best = c;
+            continue;
+         }
+         const int dc = cCum[cStart[c+1]-1];
+         const int db = cCum[cStart[best+1]-1];
+         if ( (dc<db) || ( (dc==db) && (cStart[c+1]-cStart[c]<cStart[best+1]-cStart[best]) ) )
+            best = c;
+      }
+      if ( best == -1 )
+         break;
+
+      // moving to the list of paths
+      const int np  = spf->nkPaths;
+      const int len = cStart[best+1]-cStart[best];
+      if ( np+2 > spf->capkPaths )
+      {
+         int cap = spf->capkPaths;
+         ADJUST_INT_VECTOR_CAPACITY( spf->kpStart, cap, np+2 );
+         cap = spf->capkPaths;
+         ADJUST_INT_VECTOR_CAPACITY( spf->kpDev, cap, np+2 );
+         spf->capkPaths = cap;
+      }
+      const int required = spf->kpStart[np]+len;
+      if ( required > spf->capkpNodes )
+      {
+         int cap = spf->capkpNodes;
+         ADJUST_INT_VECTOR_CAPACITY( spf->kpNodes, cap, required );
+         cap = spf->capkpNodes;
+         ADJUST_INT_VECTOR_CAPACITY( spf->kpCum, cap, required );
+         spf->capkpNodes = cap;
+      }
+      memcpy( spf->kpNodes+spf->kpStart[np], cNodes+cStart[best], sizeof(int)*len );
+      memcpy( spf->kpCum+spf->kpStart[np], cCum+cStart[best], sizeof(int)*len );
+      spf->kpStart[np+1] = spf->kpStart[np]+len;
+      spf->kpDev[np] = cDev[best];
+      spf->nkPaths++;
+
+      cSrc[best] = -2;
+   }
+
+   free( blocked );
+   free( sameRoot );
+   free( remHead );
+   if ( cStart )
+   {
+      free( cStart );
+      free( cNodes );
+      free( cCum );
+      free( cDev );
+      free( cSrc );
+   }
+
+   return spf->nkPaths;
+}
+
+int spf_k_paths( const ShortestPathsFinder *spf )
+{
+   return spf->nkPaths;
+}
+
+int spf_get_k_path( const ShortestPathsFinder *spf, const int i, int indexes[] )
+{
+   assert( i>=0 && i<spf->nkPaths );
+   const int n = spf->kpStart[i+1] - spf->kpStart[i];
+   const int *nodes = spf->kpNodes+spf->kpStart[i];
+   for ( int j=0 ; (j<n) ; ++j )
+      indexes[j] = NODE_OUT( spf, nodes[j] );
+   return n;
+}
+
+int spf_get_k_path_dist( const ShortestPathsFinder *spf, const int i )
+{
+   assert( i>=0 && i<spf->nkPaths );
+   return spf->kpCum[spf->kpStart[i+1]-1];
+}
+
+/* dist (high bits) and previous node (low bits)
+ * packed in one word, so that both are updated
+ * by a single atomic operation
+ */
+#define DS_KEY( dist, prev ) ( (((uint64_t)(dist))<<32) | ((uint32_t)(prev)) )
+#define DS_DIST( key ) ( (int)((key)>>32) )
+#define DS_PREV( key ) ( (int)((uint32_t)(key)) )
+
+typedef struct
+{
+   int *v;
+   int n;
+   int cap;
+} DSBucket;
+
+static int spf_compute_delta( ShortestPathsFinder* spf )
+{
+   if ( spf->arcs == 0 )
+      return 1;
+
+   int minW = INT_MAX, maxW = 0;
+   for ( int u=0 ; (u<spf->nodes) ; ++u )
+   {
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+      {
+         if ( n->distance >= SP_INFTY_DIST )
+            continue;
+         if ( n->distance < minW )
+            minW = n->distance;
+         if ( n->distance > maxW )
+            maxW = n->distance;
+      }
+   }
+   if ( minW <= 0 )
+      return 0;
+   if ( minW == INT_MAX )
+      return 1;
+
+   // Meyer and Sanders: delta = Theta(1/d) for weights in
+   // [0,1], d being the average degree of the graph
+   const double avgDegree = ((double)spf->arcs) / ((double)spf->nodes);
+   int delta = (int) (((double)maxW) / (avgDegree > 1.0 ? avgDegree : 1.0));
+   if ( delta < minW )
+      delta = minW;
+
+   return delta;
+}
+
+static inline void ds_push( DSBucket **buckets, int *nBuckets, const int b, const int node )
+{
+   if ( b >= *nBuckets )
+   {
+      int cap = *nBuckets;
+      ADJUST_VECTOR_CAPACITY( *buckets, cap, b+1 );
+      memset( (*buckets)+(*nBuckets), 0, sizeof(DSBucket)*(cap-(*nBuckets)) );
+      *nBuckets = cap;
+   }
+
+   DSBucket *bk = (*buckets)+b;
+   ADJUST_INT_VECTOR_CAPACITY( bk->v, bk->cap, bk->n+1 );
+   bk->v[bk->n++] = node;
+}
+
+/* atomic relaxation, returns
+ * 1 if key[node] was decreased
+ */
+static inline int ds_relax( uint64_t *key, const int node, const uint64_t newKey )
+{
+   uint64_t old = __atomic_load_n( key+node, __ATOMIC_RELAXED );
+   while ( newKey < old )
+      if ( __atomic_compare_exchange_n( key+node, &old, newKey, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+         return 1;
+
+   return 0;
+}
+
+void spf_find_parallel( ShortestPathsFinder* spf, const int _origin, const int nThreads )
+{
+   spf_check_flat( spf, "spf_find_parallel" );
+   const int origin = NODE_IN( spf, _origin );
+
+   if ( spf->delta == 0 )
+      spf->delta = spf_compute_delta( spf );
+
+   const int delta = spf->delta;
+   if ( delta == 0 )
+   {
+      // ties of zero cost arcs could produce
+      // cycles in previous, sequential version
+      spf_find( spf, _origin );
+      return;
+   }
+
+   const int nodes = spf->nodes;
+   uint64_t *key = (uint64_t*) xmalloc( sizeof(uint64_t)*nodes );
+
+   // shared state
+   int capFrontier = 1024;
+   int *frontier   = (int*) xmalloc( sizeof(int)*capFrontier );
+   int nFrontier   = 1;
+   int currBucket  = 0;
+   int nextBucket  = INT_MAX;
+   int refilled    = 0;
+   frontier[0] = origin;
+
+#ifdef _OPENMP
+   const int nt = (nThreads>0) ? nThreads : omp_get_max_threads();
+#else
+   (void) nThreads;
+#endif
+
+#pragma omp parallel num_threads(nt)
+   {
+      DSBucket *buckets = NULL;
+      int nBuckets = 0;
+      // nodes removed from the current
+      // bucket, for relaxing heavy arcs
+      int *removed = NULL;
+      int nRemoved = 0, capRemoved = 0;
+
+#pragma omp for schedule(static)
+      for ( int i=0 ; i<nodes ; ++i )
+         key[i] = DS_KEY( SP_INFTY_DIST, NULL_NODE );
+
+#pragma omp single
+      key[origin] = DS_KEY( 0, NULL_NODE );
+
+      while ( currBucket != INT_MAX )
+      {
+         const int bucket = currBucket;
+
+         // light arcs of nodes in the current bucket
+#pragma omp for schedule(dynamic,64)
+         for ( int i=0 ; i<nFrontier ; ++i )
+         {
+            const int u  = frontier[i];
+            const int du = DS_DIST( __atomic_load_n( key+u, __ATOMIC_RELAXED ) );
+            if ( du/delta != bucket )
+               continue;   // outdated entry
+
+            ADJUST_INT_VECTOR_CAPACITY( removed, capRemoved, nRemoved+1 );
+            removed[nRemoved++] = u;
+
+            for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+            {
+               if ( n->distance > delta )
+                  continue;
+               const int newDist = du + n->distance;
+               if ( ds_relax( key, n->node, DS_KEY( newDist, u ) ) )
+                  ds_push( &buckets, &nBuckets, newDist/delta, n->node );
+            }
+         } // implicit barrier
+
+         if ( (bucket<nBuckets) && (buckets[bucket].n) )
+            __atomic_store_n( &refilled, 1, __ATOMIC_RELAXED );
+#pragma omp barrier
+
+         if ( !refilled )
+         {
+            // bucket settled: heavy arcs
+            for ( int i=0 ; (i<nRemoved) ; ++i )
+            {
+               const int u  = removed[i];
+               const int du = DS_DIST( __atomic_load_n( key+u, __ATOMIC_RELAXED ) );
+               for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+               {
+                  if ( (n->distance <= delta) || (n->distance >= SP_INFTY_DIST) )
+                     continue;
+                  const int newDist = du + n->distance;
+                  if ( ds_relax( key, n->node, DS_KEY( newDist, u ) ) )
+                     ds_push( &buckets, &nBuckets, newDist/delta, n->node );
+               }
+            }
+            nRemoved = 0;
+         }
+
+         // next non empty bucket
+         for ( int b=bucket ; (b<nBuckets) ; ++b )
+         {
+            if ( buckets[b].n )
+            {
+               int curr = __atomic_load_n( &nextBucket, __ATOMIC_RELAXED );
+               while ( (b<curr) && (!__atomic_compare_exchange_n( &nextBucket, &curr, b, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED )) )
+                  ;
+               break;
+            }
+         }
+#pragma omp barrier
+
+#pragma omp single
+         {
+            currBucket = nextBucket;
+            nextBucket = INT_MAX;
+            refilled   = 0;
+            nFrontier  = 0;
+         }
+
+         // moving the next bucket to the frontier
+         int offset = 0;
+         const int nb = currBucket;
+         const int myN = ( (nb<nBuckets) ? buckets[nb].n : 0 );
+         if ( myN )
+            offset = __atomic_fetch_add( &nFrontier, myN, __ATOMIC_RELAXED );
+#pragma omp barrier
+
+#pragma omp single
+         {
+            if ( nFrontier > capFrontier )
+            {
+               capFrontier = nFrontier*2;
+               free( frontier );
+               frontier = (int*) xmalloc( sizeof(int)*capFrontier );
+            }
+         }
+
+         if ( myN )
+         {
+            memcpy( frontier+offset, buckets[nb].v, sizeof(int)*myN );
+            buckets[nb].n = 0;
+         }
+#pragma omp barrier
+      } // all buckets
+
+      for ( int b=0 ; (b<nBuckets) ; ++b )
+         if ( buckets[b].v )
+            free( buckets[b].v );
+      if ( buckets )
+         free( buckets );
+      if ( removed )
+         free( removed );
+
+#pragma omp for schedule(static)
+      for ( int i=0 ; i<nodes ; ++i )
+      {
+         spf->dist[i]     = DS_DIST( key[i] );
+         spf->previous[i] = DS_PREV( key[i] );
+      }
+   } // parallel region
+
+   free( frontier );
+   free( key );
+
+   spf->treeOrigin = origin;
+   spf->localValid = 0;
+}
+
+#undef DS_KEY
+#undef DS_DIST
+#undef DS_PREV
+
+int spf_johnson_prepare( ShortestPathsFinder* spf )
+{
+   spf_check_flat( spf, "spf_johnson_prepare" );
+   const int nodes = spf->nodes;
+
+   if ( (spf->jCapNodes<spf->capnodes) || (spf->jCapArcs<spf->caparcs) )
+   {
+      if ( spf->jCapNodes )
+      {
+         free( spf->jPot );
+         free( spf->jWeight );
+      }
+      spf->jCapNodes = spf->capnodes;
+      spf->jCapArcs  = spf->caparcs;
+      spf->jPot      = (int*) xmalloc( sizeof(int)*spf->jCapNodes );
+      spf->jWeight   = (int*) xmalloc( sizeof(int)*spf->jCapArcs );
+   }
+
+   // Bellman-Ford (queue based) from a virtual node
+   // with zero cost arcs to all nodes: all nodes
+   // start in the queue with potential 0
+   int *pot      = spf->jPot;
+   int *queue    = (int*) xmalloc( sizeof(int)*nodes );
+   int *nQueued  = (int*) xmalloc( sizeof(int)*nodes );
+   char *inQueue = (char*) xmalloc( sizeof(char)*nodes );
+   for ( int i=0 ; (i<nodes) ; ++i )
+   {
+      pot[i]     = 0;
+      queue[i]   = i;
+      nQueued[i] = 1;
+      inQueue[i] = 1;
+   }
+
+   int qStart = 0, qSize = nodes;
+   char negCycle = 0;
+   while ( (qSize) && (!negCycle) )
+   {
+      const int u = queue[qStart];
+      qStart = (qStart+1) % nodes;
+      --qSize;
+      inQueue[u] = 0;
+
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+      {
+         if ( n->distance == SP_INFTY_DIST )   // removed arc
+            continue;
+         const int newPot = pot[u] + n->distance;
+         if ( newPot >= pot[n->node] )
+            continue;
+
+         pot[n->node] = newPot;
+         if ( inQueue[n->node] )
+            continue;
+
+         // a node enters the queue more than nodes
+         // times only if there is a negative cycle
+         if ( ++nQueued[n->node] > nodes )
+         {
+            negCycle = 1;
+            break;
+         }
+         inQueue[n->node] = 1;
+         queue[(qStart+qSize) % nodes] = n->node;
+         ++qSize;
+      }
+   }
+
+   free( queue );
+   free( nQueued );
+   free( inQueue );
+
+   if ( negCycle )
+   {
+      spf->jValid = 0;
+      return 0;
+   }
+
+   for ( int u=0 ; (u<nodes) ; ++u )
+      for ( const Neighbor *n=spf->startn[u] ; (n<spf->endn[u]) ; ++n )
+         spf->jWeight[n-spf->neighs] = (n->distance == SP_INFTY_DIST) ?
+            SP_INFTY_DIST : n->distance + pot[u] - pot[n->node];
+
+   spf->jValid = 1;
+   return 1;
+}
+
+static void spf_johnson_dijkstra( const ShortestPathsFinder* spf, NodePQueuePtr npq, const int origin,
+      int dist[], int previous[] )
+{
+   const int nodes = spf->nodes;
+   const int *weight = spf->jWeight;
+
+   for ( int i=0 ; (i<nodes) ; i++ )
+      dist[i] = SP_INFTY_DIST;
+   for ( int i=0 ; (i<nodes) ; i++ )
+      previous[i] = NULL_NODE;
+   dist[origin] = 0;
+   npq_update( npq, origin, 0 );
+
+   int topCost, topNode;
+   while ( (topCost=npq_remove_first( npq, &topNode )) < SP_INFTY_DIST )
+   {
+      const Neighbor *n    = spf->startn[topNode];
+      const Neighbor *endN = spf->endn[topNode];
+      for ( ; (n<endN) ; n++ )
+      {
+         const int w = weight[n-spf->neighs];
+         if ( w == SP_INFTY_DIST )
+            continue;
+         const int toNode  = n->node;
+         const int newDist = topCost + w;
+         if ( dist[toNode] > newDist )
+         {
+            previous[toNode] = topNode;
+            dist[toNode]     = newDist;
+            npq_update( npq, toNode, newDist );
+         }
+      }
+   }
+}
+
+void spf_johnson_rows( ShortestPathsFinder* spf, const int first, const int count,
+      int distRows[], int prevRows[], const int nThreads )
+{
+   if ( (!spf->jValid) && (!spf_johnson_prepare( spf )) )
+   {
+      fprintf( stderr, "Error: graph has a negative cost cycle.\n" );
+      exit( EXIT_FAILURE );
+   }
+
+   const int nodes = spf->nodes;
+   const int *pot = spf->jPot;
+
+#ifdef _OPENMP
+   const int nt = nThreads>0 ? nThreads : omp_get_max_threads();
+#else
+   (void) nThreads;
+#endif
+
+#pragma omp parallel num_threads(nt)
+   {
+      // each thread has its own heap and labels
+      NodePQueuePtr npq = npq_create( nodes, SP_INFTY_DIST );
+      int *dist     = (int*) xmalloc( sizeof(int)*nodes );
+      int *previous = (int*) xmalloc( sizeof(int)*nodes );
+
+#pragma omp for schedule(dynamic,1)
+      for ( int r=0 ; r<count ; ++r )
+      {
+         const int origin = NODE_IN( spf, first+r );
+         spf_johnson_dijkstra( spf, npq, origin, dist, previous );
+
+         // back to the original costs and node indexes
+         int *dRow = distRows + ((size_t)r)*nodes;
+         for ( int j=0 ; (j<nodes) ; ++j )
+         {
+            const int v = NODE_IN( spf, j );
+            dRow[j] = (dist[v] == SP_INFTY_DIST) ? SP_INFTY_DIST : dist[v] - pot[origin] + pot[v];
+         }
+         if ( prevRows )
+         {
+            int *pRow = prevRows + ((size_t)r)*nodes;
+            for ( int j=0 ; (j<nodes) ; ++j )
+               pRow[j] = NODE_OUT( spf, previous[NODE_IN( spf, j )] );
+         }
+      }
+
+      npq_free( &npq );
+      free( dist );
+      free( previous );
+   }
+}
+
+static int *spf_map_file( const char *fileName, const size_t size, int *fd )
+{
+   *fd = open( fileName, O_RDWR|O_CREAT|O_TRUNC, 0644 );
+   if ( *fd < 0 )
+   {
+      fprintf( stderr, "Error: could not create file %s.\n", fileName );
+      exit( EXIT_FAILURE );
+   }
+   if ( ftruncate( *fd, size ) != 0 )
+   {
+      fprintf( stderr, "Error: could not resize file %s to %zu bytes.\n", fileName, size );
+      exit( EXIT_FAILURE );
+   }
+
+   void *result = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, *fd, 0 );
+   if ( result == MAP_FAILED )
+   {
+      fprintf( stderr, "Error: could not map file %s.\n", fileName );
+      exit( EXIT_FAILURE );
+   }
+
+   return (int *) result;
+}
+
+void spf_johnson_to_file( ShortestPathsFinder* spf, const char *distFile, const char *prevFile, const int nThreads )
+{
+   const int nodes = spf->nodes;
+   const size_t rowBytes = sizeof(int)*((size_t)nodes);
+   const size_t size = rowBytes*nodes;
+
+   int fdDist, fdPrev = -1;
+   int *dist = spf_map_file( distFile, size, &fdDist );
+   int *prev = prevFile ? spf_map_file( prevFile, size, &fdPrev ) : NULL;
+
+   // rows are computed in blocks, pages of finished blocks
+   // are written and dropped to keep memory usage bounded
+   const long pageSize = sysconf( _SC_PAGESIZE );
+   int blockRows = (int) (SPF_JOHNSON_BLOCK_BYTES / rowBytes);
+   blockRows = blockRows < 1 ? 1 : blockRows;
+   for ( int first=0 ; (first<nodes) ; first+=blockRows )
+   {
+      const int count = (first+blockRows <= nodes) ? blockRows : nodes-first;
+      const size_t offset = rowBytes*first;
+      spf_johnson_rows( spf, first, count, dist + ((size_t)first)*nodes,
+            prev ? prev + ((size_t)first)*nodes : NULL, nThreads );
+
+      // page aligned range that is complete
+      const size_t start = (offset / pageSize) * pageSize;
+      const size_t end   = ((offset + rowBytes*count) / pageSize) * pageSize;
+      if ( end > start )
+      {
+         msync( ((char *)dist) + start, end-start, MS_SYNC );
+         madvise( ((char *)dist) + start, end-start, MADV_DONTNEED );
+         if ( prev )
+         {
+            msync( ((char *)prev) + start, end-start, MS_SYNC );
+            madvise( ((char *)prev) + start, end-start, MADV_DONTNEED );
+         }
+      }
+   }
+
+   munmap( dist, size );
+   close( fdDist );
+   if ( prev )
+   {
+      munmap( prev, size );
+      close( fdPrev );
    }
 }
 
@@ -9,13 +9,37 @@
 #ifndef SPATHS_H
 #define SPATHS_H
 
+#include <stddef.h>
+
 #define SP_INFTY_DIST ((INT_MAX/2)-1)
 
 #define NULL_NODE -1
 
+/* node orders for spf_set_node_order */
+#define SPF_ORDER_NONE    0
+#define SPF_ORDER_BFS     1
+#define SPF_ORDER_RCM     2
+#define SPF_ORDER_HILBERT 3
+
+/* graph layouts for spf_set_layout */
+#define SPF_LAYOUT_AOS    0
+#define SPF_LAYOUT_SOA    1
+#define SPF_LAYOUT_COMPRESSED 2
+
 typedef struct _ShortestPathsFinder ShortestPathsFinder;
 typedef  ShortestPathsFinder * ShortestPathsFinderPtr;
 
+/* operation counters, only collected when spaths.c is
+ * compiled with -DSPF_STATS (all zero otherwise) */
+typedef struct
+{
+   long long searches;       // spf_find and searches that stop early
+   long long settled;        // nodes removed from the heap
+   long long relaxations;    // arcs scanned
+   long long heapPushes;     // nodes entering the heap
+   long long decreaseKeys;   // distance improvements of nodes in the heap
+} SPFStats;
+
 /*
  * creates Shortest Path Finder
  */
@@ -35,20 +59,94 @@ void spf_update_arc( ShortestPathsFinder* spf, const int tail, const int head, c
 int spf_get_arc( ShortestPathsFinder* spf, const int tail, const int head );
 
 /* temporarily removes
- * an arc
+ * an arc, its cost is saved
  **/
 void spf_temp_remove_arc( ShortestPathsFinder* spf, const int tail, const int head );
 
-/* temporarily removes
- * an arc
+/* restores an arc temporarily
+ * removed, with its original cost
  **/
 void spf_restore_arc( ShortestPathsFinder* spf, const int tail, const int head );
 
+/* inserts arc (tail,head) without rebuilding the graph, only
+ * its cost is updated if it exists. Each list gets free slots
+ * in the first insertion or deletion and lists without free
+ * slots are moved to the end of the arcs array.
+ **/
+void spf_insert_arc( ShortestPathsFinder* spf, const int tail, const int head, const int cost );
+
+/* deletes arc (tail,head), which must exist
+ **/
+void spf_delete_arc( ShortestPathsFinder* spf, const int tail, const int head );
+
+/* positions of the arcs array in use, including free
+ * slots, equal to spf_arcs if the lists are contiguous
+ **/
+int spf_used_arcs( const ShortestPathsFinder* spf );
+
+/* stores lists contiguously again, without free slots,
+ * after insertions and deletions have finished
+ **/
+void spf_compact( ShortestPathsFinder* spf );
+
+/* enables/disables the dynamic mode: the shortest path
+ * tree computed in the last spf_find is kept and, when arc
+ * costs change (spf_update_arc, spf_temp_remove_arc,
+ * spf_restore_arc, spf_insert_arc or spf_delete_arc), only
+ * the affected part of the tree
+ * is recomputed, so that spf_get_dist, spf_get_previous
+ * and spf_get_path remain valid without a new spf_find
+ **/
+void spf_set_dynamic( ShortestPathsFinder* spf, const char dynamic );
+
 /*
  * loads a gr file to memory, creating a new ShortestPathsFinder object
  */
 ShortestPathsFinder *spf_load_gr( const char *fileName );
 
+/*
+ * renumbers nodes internally so that nodes which are
+ * explored together are stored close to each other:
+ * SPF_ORDER_BFS (breadth first search order), SPF_ORDER_RCM
+ * (reverse Cuthill-McKee) or SPF_ORDER_HILBERT (Hilbert curve
+ * over coordinates, RCM if there are no coordinates). The order
+ * is also applied to graphs loaded later. All functions keep
+ * receiving and returning the original node indexes.
+ */
+void spf_set_node_order( ShortestPathsFinder* spf, const int method );
+
+/*
+ * SPF_LAYOUT_AOS (default) stores head and cost of each arc
+ * together, SPF_LAYOUT_SOA also keeps heads and costs in
+ * separate arrays, used by spf_find with prefetching. Faster
+ * for dense graphs, uses more memory. SPF_LAYOUT_COMPRESSED
+ * stores heads as differences and costs in variable length
+ * integers, for huge graphs: it supports the searches
+ * (spf_find, spf_find_multi, spf_find_radius, spf_find_to
+ * without landmarks, spf_find_targets, spf_find_k_paths) and
+ * query contexts, other operations stop with an error.
+ */
+void spf_set_layout( ShortestPathsFinder* spf, const int layout );
+
+/*
+ * memory used by the graph in the current layout
+ */
+size_t spf_graph_bytes( const ShortestPathsFinder* spf );
+
+/*
+ * spf_find uses an O(n^2) Dijkstra that scans an array of
+ * tentative distances and a cost matrix instead of a heap
+ * when arcs >= ratio*nodes*nodes (and nodes <= 8192).
+ * Default 0.25, values above 1 disable it.
+ */
+void spf_set_dense_threshold( ShortestPathsFinder* spf, const double ratio );
+
+/*
+ * coordinates of nodes (original
+ * indexes), for SPF_ORDER_HILBERT
+ */
+void spf_set_coordinates( ShortestPathsFinder* spf, const int nodes, const double x[], const double y[] );
+
 /*
  * queries number of nodes
  */
@@ -59,6 +157,15 @@ int spf_nodes( ShortestPathsFinder* spf );
  */
 int spf_arcs( ShortestPathsFinder* spf );
 
+/*
+ * counters of the searches since spf was created or
+ * spf_reset_stats, query contexts have their own
+ * counters. Delta-stepping and Johnson are not counted.
+ */
+SPFStats spf_stats( const ShortestPathsFinder* spf );
+
+void spf_reset_stats( ShortestPathsFinder* spf );
+
 //int spf_query_arc();
 
 /*
@@ -67,6 +174,78 @@ int spf_arcs( ShortestPathsFinder* spf );
  */
 void spf_find( ShortestPathsFinder* spf, const int origin );
 
+/*
+ * executes the shortest path finder using
+ * parallel delta-stepping (Meyer and Sanders) with
+ * nThreads (0: default number of threads), the bucket
+ * width is chosen from the arc weights. Results are
+ * queried as after spf_find.
+ */
+void spf_find_parallel( ShortestPathsFinder* spf, const int origin, const int nThreads );
+
+/*
+ * shortest paths from the nearest of several origins
+ * (multi-source Dijkstra), nodes are settled as in spf_find
+ * and spf_get_source informs which origin is the nearest
+ */
+void spf_find_multi( ShortestPathsFinder* spf, const int origins[], const int nOrigins );
+
+/*
+ * shortest paths from origin only to nodes at distance at
+ * most maxDist, the search stops at the first node farther
+ * than maxDist, other nodes remain with SP_INFTY_DIST
+ */
+void spf_find_radius( ShortestPathsFinder* spf, const int origin, const int maxDist );
+
+/*
+ * multi-source search bounded
+ * by distance maxDist
+ */
+void spf_find_multi_radius( ShortestPathsFinder* spf, const int origins[], const int nOrigins, const int maxDist );
+
+/*
+ * distance from origin to dest (SP_INFTY_DIST if not reachable),
+ * the path can be queried with spf_get_path. Uses A* with lower
+ * bounds from landmarks if spf_set_landmarks was called.
+ */
+int spf_find_to( ShortestPathsFinder* spf, const int origin, const int dest );
+
+/*
+ * selects nLandmarks landmarks (0 to disable) and computes
+ * distances from and to them, used by spf_find_to. Landmarks
+ * are computed again when needed after the graph changes.
+ * The results of the last search are kept.
+ */
+void spf_set_landmarks( ShortestPathsFinder* spf, const int nLandmarks );
+
+/*
+ * distances from origin to targets[0...k-1], written to
+ * outDist (and previous nodes to outPrev, if not NULL),
+ * SP_INFTY_DIST for unreachable targets. The search stops
+ * as soon as all targets are settled.
+ */
+void spf_find_targets( ShortestPathsFinder* spf, const int origin, const int targets[], const int k,
+      int outDist[], int outPrev[] );
+
+/*
+ * number of nodes settled by the last spf_find_multi,
+ * spf_find_radius, spf_find_multi_radius or spf_find_targets
+ */
+int spf_n_settled( const ShortestPathsFinder *spf );
+
+/*
+ * nodes settled by the last spf_find_multi, spf_find_radius,
+ * spf_find_multi_radius or spf_find_targets, in non-decreasing
+ * order of distance
+ */
+const int *spf_settled( const ShortestPathsFinder *spf );
+
+/*
+ * origin nearest to a node settled by the last
+ * spf_find_multi or spf_find_multi_radius
+ */
+int spf_get_source( const ShortestPathsFinder *spf, const int node );
+
 /*
  * solution query: returns distance to a node after executing spf_find
  */
@@ -93,6 +272,29 @@ int spf_get_path( const ShortestPathsFinder *spf, const int toNode, int indexes[
  */
 int spf_get_path_fw( const ShortestPathsFinder *spf, const int fromNode, const int toNode, int indexes[] );
 
+/* computes the k shortest loopless paths from origin
+ * to dest (Yen's algorithm), spur paths are computed
+ * with local searches over the same graph, temporarily
+ * removing arcs. Returns how many paths were found.
+ * Distances and previous nodes of spf_find are lost.
+ */
+int spf_find_k_paths( ShortestPathsFinder* spf, const int origin, const int dest, const int k );
+
+/* number of paths found in
+ * the last spf_find_k_paths
+ */
+int spf_k_paths( const ShortestPathsFinder *spf );
+
+/* fills in indexes the nodes (from origin to dest) of
+ * the i-th shortest path, returns the number of nodes
+ */
+int spf_get_k_path( const ShortestPathsFinder *spf, const int i, int indexes[] );
+
+/* returns the
+ * distance of the i-th shortest path
+ */
+int spf_get_k_path_dist( const ShortestPathsFinder *spf, const int i );
+
 /* executes All-Pairs shortest path finder using the
  * Floyd Warshall algorithm
  */
@@ -109,6 +311,36 @@ int spf_fw_ran( ShortestPathsFinder* spf );
  */
 int spf_fw_get_dist( ShortestPathsFinder* spf, const int i, const int j );
 
+/* Johnson's all pairs shortest paths, for sparse graphs
+ * with possibly negative arc costs: computes node potentials
+ * with Bellman-Ford and reduced costs. Returns 0 if there is
+ * a negative cost cycle. Called by the functions below if needed.
+ */
+int spf_johnson_prepare( ShortestPathsFinder* spf );
+
+/* distances (and previous nodes, if prevRows is not NULL)
+ * from origins first...first+count-1, the row of the r-th
+ * origin starts at distRows+r*nodes. Runs one Dijkstra per
+ * origin using nThreads threads (0: default).
+ */
+void spf_johnson_rows( ShortestPathsFinder* spf, const int first, const int count,
+      int distRows[], int prevRows[], const int nThreads );
+
+/* all pairs distances written to distFile (and previous nodes
+ * to prevFile, if not NULL) as a nodes x nodes row major
+ * matrix of native ints, through memory mapping
+ */
+void spf_johnson_to_file( ShortestPathsFinder* spf, const char *distFile, const char *prevFile, const int nThreads );
+
+/* creates a query context for the graph of spf: it has its
+ * own search data and borrows the graph, so that each thread
+ * can search the same graph with its own context. Contexts are
+ * read only and the graph of spf can't be changed while it has
+ * contexts. Contexts must be created by a single thread and
+ * released (spf_free) before spf.
+ */
+ShortestPathsFinder *spf_create_query( ShortestPathsFinder* spf );
+
 /*
  * releases Shortest Path Finder object
  */
@@ -24,21 +24,29 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <float.h>
 #include <assert.h>
 #include "tsp-instance.h"
+#include "bigmem.h"
 #include <Cbc_C_Interface.h>
 
 int main(int argc, char **argv)
 {
     if (argc<2) 
     {
-        fprintf(stderr, "usage: tsp-cbc instanceName");
+        fprintf(stderr, "usage: tsp-cbc instanceName [-hilbert]");
         exit(1);
     }
 
-    TSPInstance *inst = tspi_create(argv[1]);
+    // -hilbert renumbers cities along a Hilbert curve, so that
+    // variables of nearby cities have close indexes
+    TSPIOptions opt;
+    tspi_default_options(&opt);
+    if (argc>2 && strcmp(argv[2], "-hilbert")==0)
+        opt.reorder = TSPI_ORDER_HILBERT;
+    TSPInstance *inst = tspi_create_opt(argv[1], &opt);
 
     int n = tspi_size( inst );
 
@@ -48,7 +56,7 @@ int main(int argc, char **argv)
     int **x;  // references to variables indexes
     x = malloc(sizeof(int*)*n);
     assert(x);
-    x[0] = malloc(sizeof(int)*n*n);
+    x[0] = bm_alloc(sizeof(int)*((size_t)n)*n);   // on huge pages
     for ( int i=1 ; (i<n) ; ++i )
         x[i] = x[i-1] + n;
 
@@ -164,9 +172,12 @@ int main(int argc, char **argv)
 
     printf("best route found has length %g, best possible (obj bound) is %g\n", 
             Cbc_getObjValue(mip), Cbc_getBestPossibleObjValue(mip));
+    const double gap = Cbc_getObjValue(mip) > 0.0 ?
+        100.0*(Cbc_getObjValue(mip) - Cbc_getBestPossibleObjValue(mip)) / Cbc_getObjValue(mip) : 0.0;
+    printf("search nodes: %d, gap: %.2f%%\n", Cbc_getNodeCount(mip), gap);
 
 
-    free(x[0]);
+    bm_free(x[0], sizeof(int)*((size_t)n)*n);
     free(x);
     free(idx);
     free(coef);
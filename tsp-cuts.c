@@ -21,6 +21,25 @@
  * Solves the traveling salesman problem using a branch-and-cut algorithm
  * developed with the COIN-OR CBC MIP solver.
  * 
+ * Usage: tsp-cuts instanceName [-hilbert] [-updates file] [-state file]
+ *
+ * For repeated solves of an instance that changes a little, -updates
+ * applies the changes listed in file, one per line:
+ *
+ *   add x y       adds a city at (x, y)
+ *   move id x y   moves city id to (x, y)
+ *   remove id     removes city id
+ *
+ * Cities are identified by their number in the instance file, starting
+ * from 0, and added cities get the next numbers (see tspi_original_id).
+ * Changes apply to the instance file as read, so the list of changes
+ * grows between solves to keep city numbers consistent with the state.
+ * With -state the tour and the subtour elimination cuts saved in file
+ * by a previous solve are the initial solution and initial rows of the
+ * model, and the new tour and all cuts are saved in file at the end.
+ * State files have the lines "TOUR n" followed by the n cities of the
+ * tour, "CUTS m" and then one line per cut: its number of cities and
+ * the cities of one side of the cut.
  */
 
 #include <stdio.h>
@@ -33,6 +52,7 @@
 #include <assert.h>
 #include <Cbc_C_Interface.h>
 #include "tsp-instance.h"
+#include "bigmem.h"
 #include "spaths.h"
 #include "mincut.h"
 
@@ -55,14 +75,41 @@ static int compDistArcs( const void *p1, const void *p2 );
 // gets the nodes i and j indexes
 static char arc_nodes( const char *varName, int *i, int *j );
 
+// subtour elimination cuts, with city numbers that
+// don't change when the instance is updated
+struct CutPool
+{
+    int nCuts;
+    int capCuts;
+    int *start;     // cities of cut c are nodes[start[c]..start[c+1]-1]
+    int capNodes;
+    int *nodes;
+};
+
+static void pool_add( struct CutPool *pool, int nNodes, const int *nodes );
+
+static void apply_updates( TSPInstance *inst, const char *fileName );
+
+static int read_state( const char *fileName, int **tour, struct CutPool *pool );
+
+static void add_pool_rows( Cbc_Model *mip, const TSPInstance *inst, int **x, struct CutPool *pool );
+
+static void set_warm_start( Cbc_Model *mip, const TSPInstance *inst, int **x, const int *y,
+                            const int *prevTour, int nPrev );
+
+static void write_state( const char *fileName, Cbc_Model *mip, const TSPInstance *inst, int **x,
+                         const struct CutPool *pool );
+
 struct CutAppData 
 {
     TSPInstance *inst;
     int nPairs;              // node pairs sorted: most distant first
     struct DistArc *pairs;  
+    struct CutPool *pool;    // cuts found are stored for the next solve
 };
 
 static int cutIt = 0;
+static int cutsAdded = 0;    // subtour elimination cuts
 
 static void cut_callback( void *osiSolver, void *osiCuts, void *appData ) {
     printf("Starting cut iteration %d\n", cutIt++ );
@@ -104,6 +151,10 @@ static void cut_callback( void *osiSolver, void *osiCuts, void *appData ) {
     // checking first conectivity between distant nodes
     int iPair = caData->nPairs -1;
     MinCut *mc = NULL;
+#ifdef MINC_STATS
+    int nMinCuts = 0;
+    MinCStats cbStats = { 0, 0, 0.0 };
+#endif
     for ( ; iPair >= 0 ; --iPair ) {
         int s = caData->pairs[iPair].n1;
         int t = caData->pairs[iPair].n2;
@@ -119,6 +170,14 @@ static void cut_callback( void *osiSolver, void *osiCuts, void *appData ) {
 
         printf("cap cut: %d\n", capCut);
 
+#ifdef MINC_STATS
+        const MinCStats mcStats = minc_stats( mc );
+        ++nMinCuts;
+        cbStats.augmentingPaths += mcStats.augmentingPaths;
+        cbStats.arcsScanned += mcStats.arcsScanned;
+        cbStats.buildTime += mcStats.buildTime;
+#endif
+
         if ( (!minc_in_s(mc, s)) ) 
             continue;
         if ( (minc_in_s(mc, t)) ) 
@@ -178,10 +237,23 @@ static void cut_callback( void *osiSolver, void *osiCuts, void *appData ) {
 
 
         OsiCuts_addRowCut( osiCuts, nz, idx, coef, 'L', rhs );
+        ++cutsAdded;
+
+        int nNodes = 0;
+        for ( int v=0 ; (v<tspi_size(inst)) ; ++v )
+            if (iv[v])
+                idx[nNodes++] = tspi_original_id( inst, v );
+        pool_add( caData->pool, nNodes, idx );
 
         break;
     }
     minc_free( &mc );
+
+#ifdef MINC_STATS
+    printf("cut iteration %d: %d min cuts, %d augmenting paths, %lld arcs scanned, %.4f s building\n",
+           cutIt-1, nMinCuts, cbStats.augmentingPaths, cbStats.arcsScanned, cbStats.buildTime );
+    fflush(stdout);
+#endif
     
     free( iv );
     free( idx );
@@ -195,11 +267,32 @@ int main(int argc, char **argv)
 {
     if (argc<2) 
     {
-        fprintf(stderr, "usage: tsp-cbc instanceName");
+        fprintf(stderr, "usage: tsp-cbc instanceName [-hilbert] [-updates file] [-state file]");
         exit(1);
     }
 
-    TSPInstance *inst = tspi_create(argv[1]);
+    // -hilbert renumbers cities along a Hilbert curve, so that
+    // variables of nearby cities have close indexes
+    TSPIOptions opt;
+    tspi_default_options(&opt);
+    const char *updatesFile = NULL, *stateFile = NULL;
+    for ( int i=2 ; (i<argc) ; ++i )
+    {
+        if (strcmp(argv[i], "-hilbert")==0)
+            opt.reorder = TSPI_ORDER_HILBERT;
+        else if (strcmp(argv[i], "-updates")==0 && i+1<argc)
+            updatesFile = argv[++i];
+        else if (strcmp(argv[i], "-state")==0 && i+1<argc)
+            stateFile = argv[++i];
+        else
+        {
+            fprintf(stderr, "invalid parameter: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    TSPInstance *inst = tspi_create_opt(argv[1], &opt);
+    if (updatesFile)
+        apply_updates(inst, updatesFile);
 
     int n = tspi_size( inst );
 
@@ -209,7 +302,7 @@ int main(int argc, char **argv)
     int **x;  // references to variables indexes
     x = malloc(sizeof(int*)*n);
     assert(x);
-    x[0] = malloc(sizeof(int)*n*n);
+    x[0] = bm_alloc(sizeof(int)*((size_t)n)*n);   // on huge pages
     for ( int i=1 ; (i<n) ; ++i )
         x[i] = x[i-1] + n;
 
@@ -312,26 +405,47 @@ int main(int argc, char **argv)
         }
     }
     
+    /* warm start from the previous solve */
+    struct CutPool pool;
+    memset(&pool, 0, sizeof(pool));
+    int *prevTour = NULL;
+    int nPrev = 0;
+    if (stateFile)
+        nPrev = read_state(stateFile, &prevTour, &pool);
+    add_pool_rows(mip, inst, x, &pool);
+    if (nPrev)
+        set_warm_start(mip, inst, x, y, prevTour, nPrev);
+
     printf("initial model has %d variables, %d of which are integral and %d rows", 
             Cbc_getNumCols(mip), Cbc_getNumIntegers(mip), Cbc_getNumRows(mip));
     
     struct CutAppData caData;
     caData.inst = inst;
     caData.nPairs = compute_fartest_points( inst, &caData.pairs );
+    caData.pool = &pool;
 
     Cbc_addCutCallback(mip, cut_callback, "Sub-tour elimination", &caData, 1, 0);
     Cbc_solve(mip);
 
     printf("best route found has length %g, best possible (obj bound) is %g\n", 
             Cbc_getObjValue(mip), Cbc_getBestPossibleObjValue(mip));
+    const double gap = Cbc_getObjValue(mip) > 0.0 ?
+        100.0*(Cbc_getObjValue(mip) - Cbc_getBestPossibleObjValue(mip)) / Cbc_getObjValue(mip) : 0.0;
+    printf("search nodes: %d, cuts: %d, gap: %.2f%%\n", Cbc_getNodeCount(mip), cutsAdded, gap);
+
+    if (stateFile)
+        write_state(stateFile, mip, inst, x, &pool);
 
 
-    free( x[0] );
+    bm_free( x[0], sizeof(int)*((size_t)n)*n );
     free( x );
     free( y );
     free( idx );
     free( coef );
     free( caData.pairs );
+    free( prevTour );
+    free( pool.start );
+    free( pool.nodes );
 
     /* free cbc model */
     Cbc_deleteModel(mip);
@@ -389,6 +503,12 @@ static int compute_fartest_points( const TSPInstance *inst, struct DistArc **da
         }
     }
 
+#ifdef SPF_STATS
+    const SPFStats spfStats = spf_stats( spf );
+    printf("distant pairs: %lld searches, %lld settled, %lld relaxations, %lld pushes, %lld decrease-keys\n",
+           spfStats.searches, spfStats.settled, spfStats.relaxations, spfStats.heapPushes, spfStats.decreaseKeys );
+#endif
+
     spf_free(&spf);
     free(start);
     free(to);
@@ -425,6 +545,326 @@ static char arc_nodes( const char *varName, int *i, int *j ) {
     return 1;
 }
 
+static void pool_add( struct CutPool *pool, int nNodes, const int *nodes ) {
+    if (!pool->capCuts) {
+        pool->capCuts = 64;
+        pool->start = NEW_VECTOR( int, pool->capCuts+1 );
+        pool->start[0] = 0;
+    }
+    if (pool->nCuts == pool->capCuts) {
+        int *start = NEW_VECTOR( int, 2*pool->capCuts+1 );
+        memcpy( start, pool->start, sizeof(int)*(pool->nCuts+1) );
+        free( pool->start );
+        pool->start = start;
+        pool->capCuts *= 2;
+    }
+    const int used = pool->start[pool->nCuts];
+    if (used + nNodes > pool->capNodes) {
+        const int cap = 2*(used + nNodes);
+        int *newNodes = NEW_VECTOR( int, cap );
+        if (used)
+            memcpy( newNodes, pool->nodes, sizeof(int)*used );
+        free( pool->nodes );
+        pool->nodes = newNodes;
+        pool->capNodes = cap;
+    }
+
+    memcpy( pool->nodes + used, nodes, sizeof(int)*nNodes );
+    pool->start[++pool->nCuts] = used + nNodes;
+}
+
+// index of each city number, -1 for removed cities
+static int *city_index( const TSPInstance *inst, int *nIds ) {
+    *nIds = 0;
+    for ( int i=0 ; (i<tspi_size(inst)) ; ++i )
+        *nIds = tspi_original_id( inst, i ) >= *nIds ? tspi_original_id( inst, i )+1 : *nIds;
+
+    int *cityOf = NEW_VECTOR( int, *nIds );
+    for ( int id=0 ; (id<*nIds) ; ++id )
+        cityOf[id] = -1;
+    for ( int i=0 ; (i<tspi_size(inst)) ; ++i )
+        cityOf[tspi_original_id( inst, i )] = i;
+
+    return cityOf;
+}
+
+static int find_city( const TSPInstance *inst, int id, const char *fileName ) {
+    for ( int i=0 ; (i<tspi_size(inst)) ; ++i )
+        if (tspi_original_id( inst, i ) == id)
+            return i;
+
+    fprintf( stderr, "Error: city %d of %s not found.\n", id, fileName );
+    exit( EXIT_FAILURE );
+}
+
+static void apply_updates( TSPInstance *inst, const char *fileName ) {
+    FILE *f = fopen( fileName, "r" );
+    if (!f) {
+        fprintf( stderr, "Error: could not open file %s.\n", fileName );
+        exit( EXIT_FAILURE );
+    }
+
+    char op[64];
+    int id, nUpdates = 0;
+    double cx, cy;
+    while ( fscanf( f, "%63s", op ) == 1 ) {
+        if (strcmp( op, "add" )==0 && fscanf( f, "%lf %lf", &cx, &cy ) == 2) {
+            const int i = tspi_add_city( inst, cx, cy );
+            printf("city %d added\n", tspi_original_id( inst, i ) );
+        }
+        else if (strcmp( op, "move" )==0 && fscanf( f, "%d %lf %lf", &id, &cx, &cy ) == 3)
+            tspi_move_city( inst, find_city( inst, id, fileName ), cx, cy );
+        else if (strcmp( op, "remove" )==0 && fscanf( f, "%d", &id ) == 1)
+            tspi_remove_city( inst, find_city( inst, id, fileName ) );
+        else {
+            fprintf( stderr, "Error: invalid update %s in %s.\n", op, fileName );
+            exit( EXIT_FAILURE );
+        }
+        ++nUpdates;
+    }
+    fclose( f );
+
+    printf("%d updates applied, instance has %d cities\n", nUpdates, tspi_size( inst ) );
+}
+
+static int read_state( const char *fileName, int **tour, struct CutPool *pool ) {
+    FILE *f = fopen( fileName, "r" );
+    if (!f) {
+        printf("no state in %s, solving from scratch\n", fileName );
+        return 0;
+    }
+
+    int nTour, nCuts;
+    if (fscanf( f, " TOUR %d", &nTour ) != 1 || nTour < 0) {
+        fprintf( stderr, "Error: invalid state file %s.\n", fileName );
+        exit( EXIT_FAILURE );
+    }
+    *tour = NEW_VECTOR( int, nTour ? nTour : 1 );
+    for ( int k=0 ; (k<nTour) ; ++k ) {
+        if (fscanf( f, "%d", (*tour)+k ) != 1) {
+            fprintf( stderr, "Error: invalid tour in state file %s.\n", fileName );
+            exit( EXIT_FAILURE );
+        }
+    }
+
+    if (fscanf( f, " CUTS %d", &nCuts ) != 1) {
+        fprintf( stderr, "Error: invalid state file %s.\n", fileName );
+        exit( EXIT_FAILURE );
+    }
+    int capNodes = 64;
+    int *nodes = NEW_VECTOR( int, capNodes );
+    for ( int c=0 ; (c<nCuts) ; ++c ) {
+        int nNodes;
+        if (fscanf( f, "%d", &nNodes ) != 1 || nNodes < 0) {
+            fprintf( stderr, "Error: invalid cut in state file %s.\n", fileName );
+            exit( EXIT_FAILURE );
+        }
+        if (nNodes > capNodes) {
+            free( nodes );
+            capNodes = 2*nNodes;
+            nodes = NEW_VECTOR( int, capNodes );
+        }
+        for ( int k=0 ; (k<nNodes) ; ++k ) {
+            if (fscanf( f, "%d", nodes+k ) != 1) {
+                fprintf( stderr, "Error: invalid cut in state file %s.\n", fileName );
+                exit( EXIT_FAILURE );
+            }
+        }
+        pool_add( pool, nNodes, nodes );
+    }
+    free( nodes );
+    fclose( f );
+
+    printf("state of the previous solve: tour with %d cities, %d cuts\n", nTour, nCuts );
+
+    return nTour;
+}
+
+/* adds the cuts of the previous solve as rows, without removed cities:
+ * sum of x(i,j) for i, j in S <= |S|-1 is valid for any set S with
+ * 2 <= |S| <= n-1, so cuts stay valid when cities change */
+static void add_pool_rows( Cbc_Model *mip, const TSPInstance *inst, int **x, struct CutPool *pool ) {
+    const int n = tspi_size( inst );
+    int nIds;
+    int *cityOf = city_index( inst, &nIds );
+    char *inS = NEW_VECTOR( char, n );
+    memset( inS, 0, sizeof(char)*n );
+    int *cities = NEW_VECTOR( int, n );
+
+    struct CutPool valid;
+    memset( &valid, 0, sizeof(valid) );
+    for ( int c=0 ; (c<pool->nCuts) ; ++c ) {
+        int nS = 0;
+        for ( int k=pool->start[c] ; (k<pool->start[c+1]) ; ++k ) {
+            const int id = pool->nodes[k];
+            if (id < 0 || id >= nIds || cityOf[id] < 0 || inS[cityOf[id]])
+                continue;
+            inS[cityOf[id]] = 1;
+            cities[nS++] = cityOf[id];
+        }
+
+        for ( int k=0 ; (k<nS) ; ++k )
+            inS[cities[k]] = 0;
+        if (nS < 2 || nS > n-1)
+            continue;
+
+        int *idx = NEW_VECTOR( int, nS*(nS-1) );
+        double *coef = NEW_VECTOR( double, nS*(nS-1) );
+        int nz = 0;
+        for ( int a=0 ; (a<nS) ; ++a ) {
+            for ( int b=0 ; (b<nS) ; ++b ) {
+                if (a==b || x[cities[a]][cities[b]] == INT_MAX)
+                    continue;
+                idx[nz] = x[cities[a]][cities[b]];
+                coef[nz++] = 1.0;
+            }
+        }
+        char rname[64];
+        sprintf( rname, "sec(%d)", valid.nCuts );
+        Cbc_addRow( mip, rname, nz, idx, coef, 'L', nS-1.0 );
+        free( idx );
+        free( coef );
+
+        for ( int k=0 ; (k<nS) ; ++k )
+            cities[k] = tspi_original_id( inst, cities[k] );
+        pool_add( &valid, nS, cities );
+    }
+
+    if (pool->nCuts)
+        printf("%d of %d cuts of the previous solve added\n", valid.nCuts, pool->nCuts );
+
+    free( pool->start );
+    free( pool->nodes );
+    *pool = valid;
+    free( cityOf );
+    free( inS );
+    free( cities );
+}
+
+/* the previous tour without removed cities, added cities are
+ * inserted where they increase the length the least */
+static void set_warm_start( Cbc_Model *mip, const TSPInstance *inst, int **x, const int *y,
+                            const int *prevTour, int nPrev ) {
+    const int n = tspi_size( inst );
+    int nIds;
+    int *cityOf = city_index( inst, &nIds );
+    int *tour = NEW_VECTOR( int, n );
+    char *inTour = NEW_VECTOR( char, n );
+    memset( inTour, 0, sizeof(char)*n );
+
+    int len = 0;
+    for ( int k=0 ; (k<nPrev) ; ++k ) {
+        const int id = prevTour[k];
+        if (id < 0 || id >= nIds || cityOf[id] < 0 || inTour[cityOf[id]])
+            continue;
+        tour[len++] = cityOf[id];
+        inTour[cityOf[id]] = 1;
+    }
+
+    for ( int c=0 ; (c<n) ; ++c ) {
+        if (inTour[c])
+            continue;
+        int bestPos = len;
+        long long bestInc = LLONG_MAX;
+        for ( int p=0 ; (p<len && len>=2) ; ++p ) {
+            const int a = tour[p], b = tour[(p+1)%len];
+            const int dac = tspi_dist( inst, a, c ), dcb = tspi_dist( inst, c, b );
+            if (dac == INT_MAX || dcb == INT_MAX)
+                continue;
+            const long long inc = ((long long) dac) + dcb - tspi_dist( inst, a, b );
+            if (inc < bestInc) {
+                bestInc = inc;
+                bestPos = p+1;
+            }
+        }
+        memmove( tour+bestPos+1, tour+bestPos, sizeof(int)*(len-bestPos) );
+        tour[bestPos] = c;
+        inTour[c] = 1;
+        ++len;
+    }
+
+    const int nCols = Cbc_getNumCols( mip );
+    int *idx = NEW_VECTOR( int, nCols );
+    double *val = NEW_VECTOR( double, nCols );
+    for ( int j=0 ; (j<nCols) ; ++j ) {
+        idx[j] = j;
+        val[j] = 0.0;
+    }
+
+    // y decreases along the tour starting at city 0
+    int p0 = 0;
+    while (tour[p0] != 0)
+        ++p0;
+    long long length = 0;
+    char valid = 1;
+    for ( int k=0 ; (k<n && valid) ; ++k ) {
+        const int a = tour[(p0+k)%n], b = tour[(p0+k+1)%n];
+        valid = (n==1 || x[a][b] != INT_MAX);
+        if (!valid)
+            break;
+        if (n>1) {
+            val[x[a][b]] = 1.0;
+            length += tspi_dist( inst, a, b );
+        }
+        val[y[a]] = n-k;
+    }
+
+    if (valid) {
+        Cbc_setMIPStartI( mip, nCols, idx, val );
+        printf("warm start with a route of length %lld\n", length );
+    }
+    else
+        printf("previous route can not be completed, solving without warm start\n");
+
+    free( idx );
+    free( val );
+    free( tour );
+    free( inTour );
+    free( cityOf );
+}
+
+static void write_state( const char *fileName, Cbc_Model *mip, const TSPInstance *inst, int **x,
+                         const struct CutPool *pool ) {
+    const int n = tspi_size( inst );
+    const double *sol = Cbc_bestSolution( mip );
+    int *tour = NEW_VECTOR( int, n );
+    int nTour = 0;
+    if (sol) {
+        int cur = 0;
+        for ( ; (nTour<n) ; ++nTour ) {
+            tour[nTour] = tspi_original_id( inst, cur );
+            int next = -1;
+            for ( int j=0 ; (j<n && next<0) ; ++j )
+                if (j != cur && x[cur][j] != INT_MAX && sol[x[cur][j]] > 0.5)
+                    next = j;
+            if (next < 0)
+                break;
+            cur = next;
+        }
+        nTour = (nTour == n || n == 1) ? n : 0;
+    }
+
+    FILE *f = fopen( fileName, "w" );
+    if (!f) {
+        fprintf( stderr, "Error: could not create file %s.\n", fileName );
+        exit( EXIT_FAILURE );
+    }
+    fprintf( f, "TOUR %d\n", nTour );
+    for ( int k=0 ; (k<nTour) ; ++k )
+        fprintf( f, "%d%c", tour[k], (k%20==19 || k==nTour-1) ? '\n' : ' ' );
+    fprintf( f, "CUTS %d\n", pool->nCuts );
+    for ( int c=0 ; (c<pool->nCuts) ; ++c ) {
+        fprintf( f, "%d", pool->start[c+1]-pool->start[c] );
+        for ( int k=pool->start[c] ; (k<pool->start[c+1]) ; ++k )
+            fprintf( f, " %d", pool->nodes[k] );
+        fprintf( f, "\n" );
+    }
+    fclose( f );
+
+    printf("state with a tour of %d cities and %d cuts written to %s\n", nTour, pool->nCuts, fileName );
+    free( tour );
+}
+
 static void *xmalloc( const size_t size )
 {
    void *result = malloc( size );
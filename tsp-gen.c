@@ -0,0 +1,178 @@
+/********************************************************************************
+ * tsp-gen
+ *
+ * Generates random TSPLIB instances (EDGE_WEIGHT_TYPE EUC_2D) with uniform,
+ * clustered or grid-like points, for benchmarks over growing sizes.
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0
+ *
+ ********************************************************************************/
+
+/**
+ * @file tsp-gen.c
+ *
+ * Usage: tsp-gen uniform|clustered|grid cities [seed] [output.tsp]
+ *
+ * Points have integer coordinates in a 1000000 x 1000000 square:
+ *
+ *   uniform    uniformly distributed
+ *   clustered  around cities/10 uniform centers, with normal offsets of
+ *              standard deviation 1000000/sqrt(cities), as in the
+ *              clustered instances of the DIMACS TSP challenge
+ *   grid       on a square lattice filled row by row, each point moved
+ *              by up to a tenth of the spacing so that there are fewer
+ *              ties
+ *
+ * The generator has its own random numbers (splitmix64), so a seed
+ * (default 1) gives the same instance on every platform. Without
+ * output.tsp the instance is written to the standard output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define GEN_SIDE 1000000.0
+
+#define GEN_UNIFORM   0
+#define GEN_CLUSTERED 1
+#define GEN_GRID      2
+
+static uint64_t rngState;
+
+static uint64_t next_rand()
+{
+    uint64_t z = (rngState += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* uniform in [0,1) */
+static double rand_unit()
+{
+    return (next_rand() >> 11) * (1.0/9007199254740992.0);
+}
+
+/* standard normal, Box-Muller */
+static double rand_normal()
+{
+    const double u1 = 1.0 - rand_unit();
+    const double u2 = rand_unit();
+    return sqrt( -2.0*log( u1 ) ) * cos( 2.0*M_PI*u2 );
+}
+
+static double clamp_side( double v )
+{
+    return v < 0.0 ? 0.0 : (v > GEN_SIDE-1 ? GEN_SIDE-1 : v);
+}
+
+static void generate( int kind, int n, double *x, double *y )
+{
+    switch (kind)
+    {
+        case GEN_UNIFORM:
+            for ( int i=0 ; (i<n) ; ++i )
+            {
+                x[i] = floor( rand_unit()*GEN_SIDE );
+                y[i] = floor( rand_unit()*GEN_SIDE );
+            }
+            break;
+        case GEN_CLUSTERED:
+        {
+            const int nCenters = n/10 > 1 ? n/10 : 1;
+            const double sd = GEN_SIDE / sqrt( (double) n );
+            double *cx = malloc( sizeof(double)*nCenters );
+            double *cy = malloc( sizeof(double)*nCenters );
+            if (!cx || !cy)
+            {
+                fprintf( stderr, "No more memory available.\n" );
+                abort();
+            }
+            for ( int c=0 ; (c<nCenters) ; ++c )
+            {
+                cx[c] = rand_unit()*GEN_SIDE;
+                cy[c] = rand_unit()*GEN_SIDE;
+            }
+            for ( int i=0 ; (i<n) ; ++i )
+            {
+                const int c = (int) (rand_unit()*nCenters);
+                x[i] = floor( clamp_side( cx[c] + sd*rand_normal() ) );
+                y[i] = floor( clamp_side( cy[c] + sd*rand_normal() ) );
+            }
+            free( cx );
+            free( cy );
+            break;
+        }
+        case GEN_GRID:
+        {
+            const int side = (int) ceil( sqrt( (double) n ) );
+            const double spacing = GEN_SIDE / side;
+            for ( int i=0 ; (i<n) ; ++i )
+            {
+                const double jx = (rand_unit()-0.5)*0.2*spacing;
+                const double jy = (rand_unit()-0.5)*0.2*spacing;
+                x[i] = floor( clamp_side( (i%side + 0.5)*spacing + jx ) );
+                y[i] = floor( clamp_side( (i/side + 0.5)*spacing + jy ) );
+            }
+            break;
+        }
+    }
+}
+
+int main( int argc, char **argv )
+{
+    static const char *kinds[] = { "uniform", "clustered", "grid" };
+    int kind = -1;
+    for ( int k=0 ; (argc>1 && k<3) ; ++k )
+        if (strcmp( argv[1], kinds[k] )==0)
+            kind = k;
+
+    const int n = argc>2 ? atoi( argv[2] ) : 0;
+    if ( kind<0 || n<1 )
+    {
+        fprintf( stderr, "usage: tsp-gen uniform|clustered|grid cities [seed] [output.tsp]\n" );
+        exit( EXIT_FAILURE );
+    }
+    const long long seed = argc>3 ? atoll( argv[3] ) : 1;
+    rngState = (uint64_t) seed;
+
+    double *x = malloc( sizeof(double)*n );
+    double *y = malloc( sizeof(double)*n );
+    if (!x || !y)
+    {
+        fprintf( stderr, "No more memory available. Trying to allocate %zu bytes.", sizeof(double)*n );
+        abort();
+    }
+    generate( kind, n, x, y );
+
+    FILE *f = argc>4 ? fopen( argv[4], "w" ) : stdout;
+    if (!f)
+    {
+        fprintf( stderr, "Error: could not create file %s.\n", argv[4] );
+        exit( EXIT_FAILURE );
+    }
+    fprintf( f, "NAME: %s%d-s%lld\n", kinds[kind], n, seed );
+    fprintf( f, "TYPE: TSP\n" );
+    fprintf( f, "COMMENT: tsp-gen %s %d %lld\n", kinds[kind], n, seed );
+    fprintf( f, "DIMENSION: %d\n", n );
+    fprintf( f, "EDGE_WEIGHT_TYPE: EUC_2D\n" );
+    fprintf( f, "NODE_COORD_SECTION\n" );
+    for ( int i=0 ; (i<n) ; ++i )
+        fprintf( f, "%d %.0f %.0f\n", i+1, x[i], y[i] );
+    fprintf( f, "EOF\n" );
+    if (f != stdout && fclose( f ) != 0)
+    {
+        fprintf( stderr, "Error: could not write file %s.\n", argv[4] );
+        exit( EXIT_FAILURE );
+    }
+
+    free( x );
+    free( y );
+
+    return EXIT_SUCCESS;
+}
@@ -1,9 +1,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
-#include <assert.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "tsp-instance.h"
+#include "bigmem.h"
 
 #define PI 3.141592
 static const double RRR = 6378.388;
@@ -15,127 +22,1814 @@ static double rad(double x)
     return x*PI/180.0;
 }
 
+static void *xmalloc( const size_t size );
+
+// default memory budget for the distance matrix
+#ifndef TSPI_MAX_MATRIX_BYTES
+#define TSPI_MAX_MATRIX_BYTES (4ULL*1024*1024*1024)
+#endif
+
+// default number of rows cached when computing on demand
+#ifndef TSPI_CACHE_ROWS
+#define TSPI_CACHE_ROWS 256
+#endif
+
+// edge weight types
+#define TSPI_GEO      0
+#define TSPI_EUC_2D   1
+#define TSPI_CEIL_2D  2
+#define TSPI_ATT      3
+#define TSPI_EXPLICIT 4
+
+// how distances are stored
+#define TSPI_FULL      0   // n x n int matrix
+#define TSPI_PACKED16  1   // upper triangle with diagonal, 16 bits
+#define TSPI_PACKED32  2   // upper triangle with diagonal, 32 bits
+#define TSPI_ON_DEMAND 3   // computed from coordinates
+
+// default number of nearest neighbors per quadrant
+#ifndef TSPI_QUADRANT_NEIGHBORS
+#define TSPI_QUADRANT_NEIGHBORS 2
+#endif
+
+// maximum number of points in k-d tree leaves
+#define KD_LEAF 8
+
+// explicit matrix formats
+#define TSPI_FULL_MATRIX    0
+#define TSPI_UPPER_ROW      1
+#define TSPI_LOWER_ROW      2
+#define TSPI_UPPER_DIAG_ROW 3
+#define TSPI_LOWER_DIAG_ROW 4
+
+/* LRU cache of distance rows */
+typedef struct
+{
+    int capRows;
+    int nRows;
+    int *rows;     // capRows rows of size n
+    int *slotOf;   // slot of each row, -1 if not cached
+    int *rowOf;    // row stored in each slot
+    int *prev;     // list of slots, most recent first
+    int *next;
+    int first;
+    int last;
+
+    // last miss, to detect column scans
+    int lastI;
+    int lastJ;
+} RowCache;
+
 struct _TSPInstance
 {
     int size;
 
-    char *name;
+    // cities with room in coordinates and distances,
+    // larger than size after cities are added
+    int capacity;
+
+    char *name;
+
+    int storage;
+
+    // full matrix, only for TSPI_FULL
+    int **d;
+
+    // packed upper triangle, (i,j) with i<=j
+    // is at rowOff[i]+j
+    unsigned short *d16;
+    unsigned int *d32;
+    size_t *rowOff;
+
+    int type;
+    double **coord;
+    RowCache *cache;
+
+    // candidate lists, nbList[nbStart[i]..nbStart[i+1]-1]
+    // has the neighbors of i sorted by distance
+    int nbK;
+    int nbKq;
+    int *nbStart;
+    int *nbList;
+
+    // original number of each city if they were
+    // renumbered or updated, NULL otherwise
+    int *origId;
+
+    // number of the next added city
+    int nextId;
+
+    // mapped snapshot, coordinates and
+    // distances may point into it
+    void *map;
+    size_t mapSize;
+};
+
+// smaller instances are computed by one thread
+#ifndef TSPI_PAR_MIN_SIZE
+#define TSPI_PAR_MIN_SIZE 512
+#endif
+
+// block size when mirroring the upper triangle
+#define TSPI_MIRROR_BLOCK 64
+
+/* distance functions of TSPLIB, GEO coordinates are
+ * already in radians (latitude, longitude) */
+static inline int dist_geo(double latitude_i, double longitude_i, double latitude_j, double longitude_j)
+{
+    double q1 = cos(longitude_i - longitude_j);
+    double q2 = cos(latitude_i - latitude_j);
+    double q3 = cos(latitude_i + latitude_j);
+    return (int)( RRR * acos( 0.5 * ( ( 1.0 + q1 ) * q2 - (1.0 - q1) * q3 ) ) + 1.0 );
+}
+
+static inline int dist_euc_2d(double xi, double yi, double xj, double yj)
+{
+    const double xd = xi - xj, yd = yi - yj;
+    return nint( sqrt( xd*xd + yd*yd ) );
+}
+
+static inline int dist_ceil_2d(double xi, double yi, double xj, double yj)
+{
+    const double xd = xi - xj, yd = yi - yj;
+    return (int) ceil( sqrt( xd*xd + yd*yd ) );
+}
+
+static inline int dist_att(double xi, double yi, double xj, double yj)
+{
+    const double xd = xi - xj, yd = yi - yj;
+    const double r = sqrt( (xd*xd + yd*yd) / 10.0 );
+    const int t = nint( r );
+    return t < r ? t+1 : t;
+}
+
+/* all distance functions are symmetric (for GEO cos is even
+ * and the sum of latitudes commutes), so only j>=i is
+ * evaluated and then copied to the lower triangle */
+static void mirror_distances(TSPInstance *inst)
+{
+    int **d = inst->d;
+    const int n = inst->size;
+
+#pragma omp parallel for schedule(dynamic,1) if(n>=TSPI_PAR_MIN_SIZE)
+    for ( int bi=0 ; bi<n ; bi+=TSPI_MIRROR_BLOCK )
+    {
+        const int endI = bi+TSPI_MIRROR_BLOCK < n ? bi+TSPI_MIRROR_BLOCK : n;
+        for ( int bj=0 ; bj<=bi ; bj+=TSPI_MIRROR_BLOCK )
+        {
+            const int endJ = bj+TSPI_MIRROR_BLOCK < n ? bj+TSPI_MIRROR_BLOCK : n;
+            for ( int i=bi ; i<endI ; ++i )
+                for ( int j=bj ; j<endJ && j<i ; ++j )
+                    d[i][j] = d[j][i];
+        }
+    }
+}
+
+/* kernels per edge weight type, so that the distance function
+ * is inlined in the loop: the matrix kernels for the full and
+ * for the packed storage (rows get shorter and dynamic scheduling
+ * balances them) and the row kernel used when distances are
+ * computed on demand */
+#define COORD_KERNEL( name, distf ) \
+static void row_##name(const TSPInstance *inst, int i, int *row) \
+{ \
+    double **coord = inst->coord; \
+    const double xi = coord[i][0], yi = coord[i][1]; \
+    for ( int j=0 ; j<inst->size ; ++j ) \
+        row[j] = distf( xi, yi, coord[j][0], coord[j][1] ); \
+} \
+static void compute_##name(TSPInstance *inst, double **coord) \
+{ \
+    int **d = inst->d; \
+    const int n = inst->size; \
+    _Pragma("omp parallel for schedule(dynamic,16) if(n>=TSPI_PAR_MIN_SIZE)") \
+    for (int i=0 ; i<n; ++i ) \
+    { \
+        const double xi = coord[i][0], yi = coord[i][1]; \
+        int *di = d[i]; \
+        for ( int j=i ; j<n ; ++j ) \
+            di[j] = distf( xi, yi, coord[j][0], coord[j][1] ); \
+    } \
+    mirror_distances( inst ); \
+} \
+static int pack_##name(TSPInstance *inst, double **coord) \
+{ \
+    unsigned int *tri = inst->d32; \
+    const size_t *rowOff = inst->rowOff; \
+    const int n = inst->size; \
+    int maxD = 0; \
+    _Pragma("omp parallel for schedule(dynamic,16) reduction(max:maxD) if(n>=TSPI_PAR_MIN_SIZE)") \
+    for (int i=0 ; i<n; ++i ) \
+    { \
+        const double xi = coord[i][0], yi = coord[i][1]; \
+        unsigned int *ti = tri + rowOff[i]; \
+        for ( int j=i ; j<n ; ++j ) \
+        { \
+            const int dij = distf( xi, yi, coord[j][0], coord[j][1] ); \
+            ti[j] = dij; \
+            maxD = dij > maxD ? dij : maxD; \
+        } \
+    } \
+    return maxD; \
+}
+
+COORD_KERNEL( geo, dist_geo )
+COORD_KERNEL( euc_2d, dist_euc_2d )
+COORD_KERNEL( ceil_2d, dist_ceil_2d )
+COORD_KERNEL( att, dist_att )
+
+static void compute_distances(TSPInstance *inst, double **coord, int type)
+{
+    switch (type)
+    {
+        case TSPI_GEO:
+            compute_geo( inst, coord );
+            break;
+        case TSPI_EUC_2D:
+            compute_euc_2d( inst, coord );
+            break;
+        case TSPI_CEIL_2D:
+            compute_ceil_2d( inst, coord );
+            break;
+        case TSPI_ATT:
+            compute_att( inst, coord );
+            break;
+    }
+}
+
+static int pack_distances(TSPInstance *inst, double **coord, int type)
+{
+    switch (type)
+    {
+        case TSPI_GEO:
+            return pack_geo( inst, coord );
+        case TSPI_EUC_2D:
+            return pack_euc_2d( inst, coord );
+        case TSPI_CEIL_2D:
+            return pack_ceil_2d( inst, coord );
+        default:
+            return pack_att( inst, coord );
+    }
+}
+
+static void compute_row(const TSPInstance *inst, int i, int *row)
+{
+    switch (inst->type)
+    {
+        case TSPI_GEO:
+            row_geo( inst, i, row );
+            break;
+        case TSPI_EUC_2D:
+            row_euc_2d( inst, i, row );
+            break;
+        case TSPI_CEIL_2D:
+            row_ceil_2d( inst, i, row );
+            break;
+        case TSPI_ATT:
+            row_att( inst, i, row );
+            break;
+    }
+}
+
+static int coord_dist(const TSPInstance *inst, int i, int j)
+{
+    const double *ci = inst->coord[i], *cj = inst->coord[j];
+    switch (inst->type)
+    {
+        case TSPI_GEO:
+            return dist_geo( ci[0], ci[1], cj[0], cj[1] );
+        case TSPI_EUC_2D:
+            return dist_euc_2d( ci[0], ci[1], cj[0], cj[1] );
+        case TSPI_CEIL_2D:
+            return dist_ceil_2d( ci[0], ci[1], cj[0], cj[1] );
+        default:
+            return dist_att( ci[0], ci[1], cj[0], cj[1] );
+    }
+}
+
+static RowCache *cache_create(int capRows, int n)
+{
+    RowCache *cache = xmalloc(sizeof(RowCache));
+    cache->capRows = capRows;
+    cache->nRows = 0;
+    cache->rows = xmalloc(sizeof(int)*((size_t)capRows)*n);
+    cache->slotOf = xmalloc(sizeof(int)*(n+4*capRows));
+    cache->rowOf = cache->slotOf + n;
+    cache->prev = cache->rowOf + capRows;
+    cache->next = cache->prev + capRows;
+    for ( int i=0 ; i<n ; ++i )
+        cache->slotOf[i] = -1;
+    cache->first = cache->last = -1;
+    cache->lastI = cache->lastJ = -1;
+    return cache;
+}
+
+static void cache_free(RowCache *cache)
+{
+    free(cache->rows);
+    free(cache->slotOf);
+    free(cache);
+}
+
+static void cache_unlink(RowCache *cache, int slot)
+{
+    if (cache->prev[slot] >= 0)
+        cache->next[cache->prev[slot]] = cache->next[slot];
+    else
+        cache->first = cache->next[slot];
+    if (cache->next[slot] >= 0)
+        cache->prev[cache->next[slot]] = cache->prev[slot];
+    else
+        cache->last = cache->prev[slot];
+}
+
+static void cache_push_front(RowCache *cache, int slot)
+{
+    cache->prev[slot] = -1;
+    cache->next[slot] = cache->first;
+    if (cache->first >= 0)
+        cache->prev[cache->first] = slot;
+    cache->first = slot;
+    if (cache->last < 0)
+        cache->last = slot;
+}
+
+/* returns row i, computing it in the
+ * least recently used slot if needed */
+static const int *cache_row(const TSPInstance *inst, int i)
+{
+    RowCache *cache = inst->cache;
+    int slot = cache->slotOf[i];
+    if (slot >= 0)
+    {
+        if (slot != cache->first)
+        {
+            cache_unlink(cache, slot);
+            cache_push_front(cache, slot);
+        }
+        return cache->rows + ((size_t)slot)*inst->size;
+    }
+
+    if (cache->nRows < cache->capRows)
+        slot = cache->nRows++;
+    else
+    {
+        slot = cache->last;
+        cache_unlink(cache, slot);
+        cache->slotOf[cache->rowOf[slot]] = -1;
+    }
+    cache->slotOf[i] = slot;
+    cache->rowOf[slot] = i;
+    cache_push_front(cache, slot);
+
+    int *row = cache->rows + ((size_t)slot)*inst->size;
+    compute_row(inst, i, row);
+    return row;
+}
+
+/* text being parsed, the file is mapped and not NUL terminated */
+typedef struct
+{
+    const char *p;
+    const char *end;
+    const char *fileName;
+} Cursor;
+
+static void parse_error(const Cursor *c, const char *message)
+{
+    fprintf(stderr, "Error: %s in %s.\n", message, c->fileName);
+    exit(EXIT_FAILURE);
+}
+
+static void skip_spaces(Cursor *c)
+{
+    while (c->p < c->end && isspace((unsigned char) *c->p))
+        ++c->p;
+}
+
+static void skip_line(Cursor *c)
+{
+    while (c->p < c->end && *c->p != '\n')
+        ++c->p;
+}
+
+static char parse_int(Cursor *c, int *value)
+{
+    skip_spaces(c);
+    const char *p = c->p;
+    char neg = 0;
+    if (p < c->end && (*p == '-' || *p == '+'))
+        neg = *(p++) == '-';
+    if (p == c->end || !isdigit((unsigned char) *p))
+        return 0;
+    long long v = 0;
+    while (p < c->end && isdigit((unsigned char) *p))
+    {
+        v = v*10 + (*(p++) - '0');
+        if (v > INT_MAX)
+            parse_error(c, "integer too large");
+    }
+    c->p = p;
+    *value = (int) (neg ? -v : v);
+    return 1;
+}
+
+static const double exactPow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/* decimals with up to 15 digits and small exponents are converted
+ * with one correctly rounded operation on exact values, giving the
+ * same result as strtod, which converts the others */
+static char parse_double(Cursor *c, double *value)
+{
+    skip_spaces(c);
+    const char *p = c->p;
+    char neg = 0;
+    if (p < c->end && (*p == '-' || *p == '+'))
+        neg = *(p++) == '-';
+    unsigned long long m = 0;
+    int nDigits = 0, exp10 = 0;
+    char hasDigits = 0;
+    while (p < c->end && isdigit((unsigned char) *p))
+    {
+        if (m || *p != '0')
+            ++nDigits;
+        m = m*10 + (*(p++) - '0');
+        hasDigits = 1;
+        if (nDigits > 15)
+            break;
+    }
+    if (p < c->end && *p == '.' && nDigits <= 15)
+    {
+        ++p;
+        while (p < c->end && isdigit((unsigned char) *p))
+        {
+            if (m || *p != '0')
+                ++nDigits;
+            m = m*10 + (*(p++) - '0');
+            --exp10;
+            hasDigits = 1;
+            if (nDigits > 15)
+                break;
+        }
+    }
+    if (!hasDigits)
+        return 0;
+    if (p < c->end && (*p == 'e' || *p == 'E') && nDigits <= 15)
+    {
+        Cursor ce = { p+1, c->end, c->fileName };
+        int e;
+        if (p+1 == c->end || isspace((unsigned char) p[1]) || !parse_int(&ce, &e))
+            return 0;
+        exp10 += e;
+        p = ce.p;
+    }
+
+    if (nDigits <= 15 && exp10 >= -22 && exp10 <= 22 && (p == c->end || !isdigit((unsigned char) *p)))
+    {
+        const double v = exp10 >= 0 ? ((double) m) * exactPow10[exp10] : ((double) m) / exactPow10[-exp10];
+        *value = neg ? -v : v;
+        c->p = p;
+        return 1;
+    }
+
+    // long or unusual number
+    char buf[128];
+    const char *start = c->p;
+    size_t len = 0;
+    while (start+len < c->end && !isspace((unsigned char) start[len]) && len < sizeof(buf)-1)
+    {
+        buf[len] = start[len];
+        ++len;
+    }
+    buf[len] = '\0';
+    char *e;
+    *value = strtod(buf, &e);
+    if (e == buf)
+        return 0;
+    c->p = start + (e-buf);
+    return 1;
+}
+
+/* reads a word, up to a space or ':' */
+static size_t parse_word(Cursor *c, const char **word)
+{
+    *word = c->p;
+    while (c->p < c->end && !isspace((unsigned char) *c->p) && *c->p != ':')
+        ++c->p;
+    return c->p - *word;
+}
+
+static char word_is(const char *word, size_t len, const char *str)
+{
+    return strlen(str) == len && strncmp(word, str, len) == 0;
+}
+
+/* value of the header, up to the end of the line without spaces */
+static size_t parse_value(Cursor *c, const char **value)
+{
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t'))
+        ++c->p;
+    *value = c->p;
+    skip_line(c);
+    const char *e = c->p;
+    while (e > *value && isspace((unsigned char) e[-1]))
+        --e;
+    return e - *value;
+}
+
+static int parse_option(const Cursor *c, const char *value, size_t len, const char *options[], int nOptions, const char *key)
+{
+    for ( int i=0 ; i<nOptions ; ++i )
+        if (word_is(value, len, options[i]))
+            return i;
+
+    fprintf(stderr, "Error: %s %.*s in %s is not supported.\n", key, (int) len, value, c->fileName);
+    exit(EXIT_FAILURE);
+}
+
+/* reads the EDGE_WEIGHT_SECTION directly into d */
+static void read_explicit(TSPInstance *inst, Cursor *c, int format)
+{
+    int **d = inst->d;
+    const int n = inst->size;
+    for ( int i=0 ; i<n ; ++i )
+    {
+        int startJ = 0, endJ = n;
+        switch (format)
+        {
+            case TSPI_UPPER_ROW:
+                startJ = i+1;
+                break;
+            case TSPI_LOWER_ROW:
+                endJ = i;
+                break;
+            case TSPI_UPPER_DIAG_ROW:
+                startJ = i;
+                break;
+            case TSPI_LOWER_DIAG_ROW:
+                endJ = i+1;
+                break;
+        }
+        for ( int j=startJ ; j<endJ ; ++j )
+            if (!parse_int(c, &d[i][j]))
+                parse_error(c, "incomplete EDGE_WEIGHT_SECTION");
+    }
+
+    if (format == TSPI_FULL_MATRIX)
+        return;
+
+    if (format == TSPI_UPPER_ROW || format == TSPI_LOWER_ROW)
+        for ( int i=0 ; i<n ; ++i )
+            d[i][i] = 0;
+
+    // triangular formats are stored in the upper triangle
+    if (format == TSPI_LOWER_ROW || format == TSPI_LOWER_DIAG_ROW)
+        for ( int i=0 ; i<n ; ++i )
+            for ( int j=0 ; j<i ; ++j )
+                d[j][i] = d[i][j];
+
+    mirror_distances( inst );
+}
+
+/* stores coordinates in the units of the file */
+static void set_coord(TSPInstance *inst, int i, double x, double y)
+{
+    if (inst->type == TSPI_GEO)
+    {
+        inst->coord[i][0] = rad(x);
+        inst->coord[i][1] = rad(y);
+    }
+    else
+    {
+        inst->coord[i][0] = x;
+        inst->coord[i][1] = y;
+    }
+}
+
+/* each node must appear once, so that all cities have coordinates */
+static void read_coordinates(TSPInstance *inst, Cursor *c)
+{
+    char *seen = xmalloc(inst->size);
+    memset(seen, 0, inst->size);
+    for ( int k=0 ; k<inst->size ; ++k )
+    {
+        int i;
+        double x, y;
+        if (!parse_int(c, &i) || !parse_double(c, &x) || !parse_double(c, &y))
+            parse_error(c, "incomplete NODE_COORD_SECTION");
+        if (i < 1 || i > inst->size)
+            parse_error(c, "invalid node in NODE_COORD_SECTION");
+        if (seen[i-1])
+            parse_error(c, "repeated node in NODE_COORD_SECTION");
+        seen[i-1] = 1;
+        set_coord(inst, i-1, x, y);
+    }
+    free(seen);
+}
+
+static void alloc_coord(TSPInstance *inst, double *data)
+{
+    inst->coord = xmalloc(sizeof(double*)*inst->capacity);
+    inst->coord[0] = data ? data : xmalloc(sizeof(double)*inst->capacity*2);
+    for ( int i=1 ; (i<inst->capacity) ; ++i )
+        inst->coord[i] = inst->coord[i-1]+2;
+}
+
+static void alloc_matrix(TSPInstance *inst);
+
+/* parses a TSPLIB file, filling coordinates or, for
+ * EXPLICIT instances, the distance matrix */
+static void parse_tsplib(TSPInstance *inst, const char *text, size_t size, const char fileName[])
+{
+    static const char *types[] = { "GEO", "EUC_2D", "CEIL_2D", "ATT", "EXPLICIT" };
+    static const char *formats[] = { "FULL_MATRIX", "UPPER_ROW", "LOWER_ROW", "UPPER_DIAG_ROW", "LOWER_DIAG_ROW" };
+    int format = TSPI_FULL_MATRIX;
+    char hasCoord = 0, hasWeights = 0;
+    inst->type = TSPI_GEO;
+
+    Cursor c = { text, text+size, fileName };
+    while (1)
+    {
+        skip_spaces(&c);
+        if (c.p == c.end)
+            break;
+
+        const char *word, *value;
+        const size_t len = parse_word(&c, &word);
+        while (c.p < c.end && (*c.p == ' ' || *c.p == '\t'))
+            ++c.p;
+        if (c.p < c.end && *c.p == ':')
+        {
+            ++c.p;
+            const size_t vLen = parse_value(&c, &value);
+            if (word_is(word, len, "NAME"))
+            {
+                inst->name = xmalloc(vLen+1);
+                memcpy(inst->name, value, vLen);
+                inst->name[vLen] = '\0';
+            }
+            else if (word_is(word, len, "DIMENSION"))
+            {
+                Cursor cv = { value, value+vLen, fileName };
+                if (inst->size || !parse_int(&cv, &inst->size) || inst->size < 1)
+                    parse_error(&c, "invalid DIMENSION");
+                inst->capacity = inst->size;
+            }
+            else if (word_is(word, len, "EDGE_WEIGHT_TYPE"))
+                inst->type = parse_option(&c, value, vLen, types, sizeof(types)/sizeof(types[0]), "EDGE_WEIGHT_TYPE");
+            else if (word_is(word, len, "EDGE_WEIGHT_FORMAT") && !word_is(value, vLen, "FUNCTION"))
+                format = parse_option(&c, value, vLen, formats, sizeof(formats)/sizeof(formats[0]), "EDGE_WEIGHT_FORMAT");
+            continue;
+        }
+
+        if (word_is(word, len, "EOF"))
+            break;
+        if (len == 0)
+            parse_error(&c, "invalid line");
+
+        skip_line(&c);
+        if ((word_is(word, len, "NODE_COORD_SECTION") || word_is(word, len, "EDGE_WEIGHT_SECTION")) && !inst->size)
+            parse_error(&c, "section before DIMENSION");
+        if (word_is(word, len, "NODE_COORD_SECTION") && inst->type != TSPI_EXPLICIT && !hasCoord)
+        {
+            alloc_coord(inst, NULL);
+            read_coordinates(inst, &c);
+            hasCoord = 1;
+        }
+        else if (word_is(word, len, "EDGE_WEIGHT_SECTION") && !hasWeights)
+        {
+            alloc_matrix(inst);
+            read_explicit(inst, &c, format);
+            hasWeights = 1;
+        }
+        else
+        {
+            // other sections, skipped up to the next keyword
+            while (1)
+            {
+                skip_spaces(&c);
+                if (c.p == c.end || isalpha((unsigned char) *c.p))
+                    break;
+                skip_line(&c);
+            }
+        }
+    }
+
+    if ( (inst->type == TSPI_EXPLICIT && !hasWeights) || (inst->type != TSPI_EXPLICIT && !hasCoord) )
+    {
+        fprintf(stderr, "Error: %s has no %s.\n", fileName,
+                inst->type == TSPI_EXPLICIT ? "EDGE_WEIGHT_SECTION" : "NODE_COORD_SECTION");
+        exit(EXIT_FAILURE);
+    }
+    if (inst->type == TSPI_EXPLICIT)
+        inst->storage = TSPI_FULL;
+}
+
+static size_t packed_size(int n)
+{
+    return ((size_t)n)*(n+1)/2;
+}
+
+/* bytes of the distances of n cities, 0 if not stored */
+static size_t dist_bytes(int storage, int n)
+{
+    switch (storage)
+    {
+        case TSPI_PACKED16:
+            return sizeof(unsigned short)*packed_size(n);
+        case TSPI_PACKED32:
+            return sizeof(unsigned int)*packed_size(n);
+        case TSPI_FULL:
+            return sizeof(int)*((size_t)n)*n;
+    }
+    return 0;
+}
+
+/* matrices are allocated with bm_alloc, on huge pages */
+static void alloc_matrix(TSPInstance *inst)
+{
+    inst->d = xmalloc(sizeof(int*)*inst->capacity);
+    inst->d[0] = bm_alloc(dist_bytes(TSPI_FULL, inst->capacity));
+    for ( int i=1 ; (i<inst->capacity) ; ++i )
+        inst->d[i] = inst->d[i-1] + inst->capacity;
+}
+
+static void compute_row_offsets(TSPInstance *inst)
+{
+    const int n = inst->capacity;
+    inst->rowOff = xmalloc(sizeof(size_t)*n);
+    size_t start = 0;
+    for ( int i=0 ; i<n ; ++i )
+    {
+        inst->rowOff[i] = start - i;
+        start += n-i;
+    }
+}
+
+/* allocates the 32 bit packed triangle */
+static void alloc_packed(TSPInstance *inst)
+{
+    compute_row_offsets(inst);
+    inst->d32 = bm_alloc(dist_bytes(TSPI_PACKED32, inst->capacity));
+    inst->storage = TSPI_PACKED32;
+}
+
+/* moves the packed triangle to 16 bits if maxD fits */
+static void narrow_packed(TSPInstance *inst, int maxD)
+{
+    if (maxD > USHRT_MAX)
+        return;
+
+    const size_t size = packed_size(inst->capacity);
+    inst->d16 = bm_alloc(dist_bytes(TSPI_PACKED16, inst->capacity));
+    const unsigned int *d32 = inst->d32;
+    unsigned short *d16 = inst->d16;
+#pragma omp parallel for if(inst->size>=TSPI_PAR_MIN_SIZE)
+    for ( size_t p=0 ; p<size ; ++p )
+        d16[p] = (unsigned short) d32[p];
+    bm_free(inst->d32, dist_bytes(TSPI_PACKED32, inst->capacity));
+    inst->d32 = NULL;
+    inst->storage = TSPI_PACKED16;
+}
+
+/* replaces a symmetric full matrix without
+ * negative distances by the packed triangle */
+static void pack_matrix(TSPInstance *inst)
+{
+    int **d = inst->d;
+    const int n = inst->size;
+    int maxD = 0;
+    for ( int i=0 ; i<n ; ++i )
+    {
+        for ( int j=i ; j<n ; ++j )
+        {
+            if (d[i][j] != d[j][i] || d[i][j] < 0)
+                return;
+            maxD = d[i][j] > maxD ? d[i][j] : maxD;
+        }
+    }
+
+    alloc_packed(inst);
+    for ( int i=0 ; i<n ; ++i )
+        for ( int j=i ; j<n ; ++j )
+            inst->d32[inst->rowOff[i]+j] = d[i][j];
+    bm_free(d[0], dist_bytes(TSPI_FULL, inst->capacity));
+    free(d);
+    inst->d = NULL;
+    narrow_packed(inst, maxD);
+}
+
+void tspi_default_options(TSPIOptions *opt)
+{
+    opt->maxMatrixBytes = TSPI_MAX_MATRIX_BYTES;
+    opt->cacheRows = TSPI_CACHE_ROWS;
+    opt->compact = 1;
+    opt->reorder = TSPI_ORDER_FILE;
+}
+
+TSPInstance *tspi_create(const char fileName[])
+{
+    return tspi_create_opt(fileName, NULL);
+}
+
+static char in_map(const TSPInstance *inst, const void *p)
+{
+    return inst->map && (const char *) p >= (const char *) inst->map &&
+        (const char *) p < ((const char *) inst->map) + inst->mapSize;
+}
+
+/* frees memory not in the snapshot mapping */
+static void free_owned(const TSPInstance *inst, void *p)
+{
+    if (p && !in_map(inst, p))
+        free(p);
+}
+
+/* frees distances of bm_alloc not in the snapshot mapping */
+static void free_matrix(const TSPInstance *inst, void *p, int storage, int capacity)
+{
+    if (p && !in_map(inst, p))
+        bm_free(p, dist_bytes(storage, capacity));
+}
+
+/* position of (x,y) along the Hilbert curve
+ * filling a grid of 2^16 x 2^16 cells */
+static uint64_t hilbert_index(uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+    for ( uint32_t s=1u<<15 ; s>0 ; s>>=1 )
+    {
+        const uint32_t rx = (x & s) > 0;
+        const uint32_t ry = (y & s) > 0;
+        d += ((uint64_t) s) * s * ((3*rx) ^ ry);
+        // rotates the quadrant
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s-1 - (x & (s-1));
+                y = s-1 - (y & (s-1));
+            }
+            const uint32_t t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+typedef struct
+{
+    uint64_t key;
+    int id;
+} KeyId;
+
+static int cmp_key_id(const void *p1, const void *p2)
+{
+    const KeyId *a = p1, *b = p2;
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+    return a->id - b->id;
+}
+
+/* renumbers cities in the order they are visited by a Hilbert
+ * curve over the bounding box of the coordinates */
+static void hilbert_order(TSPInstance *inst)
+{
+    const int n = inst->size;
+    double **coord = inst->coord;
+    double minC[2] = { coord[0][0], coord[0][1] }, maxC[2] = { coord[0][0], coord[0][1] };
+    for ( int i=1 ; i<n ; ++i )
+    {
+        for ( int d=0 ; d<2 ; ++d )
+        {
+            minC[d] = coord[i][d] < minC[d] ? coord[i][d] : minC[d];
+            maxC[d] = coord[i][d] > maxC[d] ? coord[i][d] : maxC[d];
+        }
+    }
+    double scale[2];
+    for ( int d=0 ; d<2 ; ++d )
+        scale[d] = maxC[d] > minC[d] ? 65535.0 / (maxC[d]-minC[d]) : 0.0;
+
+    KeyId *order = xmalloc(sizeof(KeyId)*n);
+    for ( int i=0 ; i<n ; ++i )
+    {
+        const uint32_t x = (uint32_t) ((coord[i][0]-minC[0])*scale[0]);
+        const uint32_t y = (uint32_t) ((coord[i][1]-minC[1])*scale[1]);
+        order[i].key = hilbert_index(x, y);
+        order[i].id = i;
+    }
+    qsort(order, n, sizeof(KeyId), cmp_key_id);
+
+    double *newCoord = xmalloc(sizeof(double)*2*n);
+    inst->origId = xmalloc(sizeof(int)*n);
+    for ( int i=0 ; i<n ; ++i )
+    {
+        newCoord[2*i] = coord[order[i].id][0];
+        newCoord[2*i+1] = coord[order[i].id][1];
+        inst->origId[i] = order[i].id;
+    }
+    free(order);
+
+    free_owned(inst, coord[0]);
+    free(coord);
+    alloc_coord(inst, newCoord);
+}
+
+/* header of binary snapshots, in native byte order, followed
+ * by the name, the coordinates (2 doubles per city, latitude
+ * and longitude in radians for GEO), the original numbers of
+ * renumbered cities and the distances as stored in the
+ * instance, sections aligned to TSPI_SNAP_ALIGN */
+typedef struct
+{
+    char magic[8];
+    int32_t size;
+    int32_t type;
+    int32_t storage;    // storage of the distances
+    int32_t nameLen;
+    int64_t nameOffset;
+    int64_t coordOffset;   // 0 if there are no coordinates
+    int64_t origIdOffset;  // 0 if cities were not renumbered
+    int64_t distOffset;    // 0 if there are no distances
+    int64_t fileSize;
+} SnapHeader;
+
+static const char snapMagic[8] = { 'T', 'S', 'P', 'I', 'S', 'N', 'P', '2' };
+
+#define TSPI_SNAP_ALIGN 64
+
+/* checks that a section of bytes at offset, a multiple of
+ * align, lies after the header and inside the mapping */
+static char snap_section_ok(const TSPInstance *inst, int64_t offset, size_t bytes, int64_t align)
+{
+    return offset >= (int64_t) sizeof(SnapHeader) && offset % align == 0 &&
+           (uint64_t) offset <= inst->mapSize && bytes <= inst->mapSize - (size_t) offset;
+}
+
+/* uses the coordinates and distances of a mapped snapshot
+ * in place, returns 1 if it has distances */
+static char load_snapshot(TSPInstance *inst, const char fileName[])
+{
+    const SnapHeader *h = inst->map;
+    if (inst->mapSize < sizeof(SnapHeader) || h->fileSize != (int64_t) inst->mapSize || h->size < 1 ||
+        h->type < TSPI_GEO || h->type > TSPI_EXPLICIT || (h->distOffset && dist_bytes(h->storage, h->size) == 0) ||
+        (!h->coordOffset && !h->distOffset) || h->nameLen < 0 ||
+        !snap_section_ok(inst, h->nameOffset, (size_t) h->nameLen, 1) ||
+        (h->coordOffset && !snap_section_ok(inst, h->coordOffset, 2*sizeof(double)*h->size, TSPI_SNAP_ALIGN)) ||
+        (h->origIdOffset && !snap_section_ok(inst, h->origIdOffset, sizeof(int)*h->size, TSPI_SNAP_ALIGN)) ||
+        (h->distOffset && !snap_section_ok(inst, h->distOffset, dist_bytes(h->storage, h->size), TSPI_SNAP_ALIGN)))
+    {
+        fprintf(stderr, "Error: invalid snapshot %s.\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *base = inst->map;
+    inst->size = inst->capacity = h->size;
+    inst->type = h->type;
+    inst->name = xmalloc(h->nameLen+1);
+    memcpy(inst->name, base+h->nameOffset, h->nameLen);
+    inst->name[h->nameLen] = '\0';
+    if (h->coordOffset)
+        alloc_coord(inst, (double *) (base+h->coordOffset));
+    if (h->origIdOffset)
+        inst->origId = (int *) (base+h->origIdOffset);
+    if (!h->distOffset)
+        return 0;
+
+    inst->storage = h->storage;
+    const int n = inst->size;
+    switch (h->storage)
+    {
+        case TSPI_PACKED16:
+            inst->d16 = (unsigned short *) (base+h->distOffset);
+            compute_row_offsets(inst);
+            break;
+        case TSPI_PACKED32:
+            inst->d32 = (unsigned int *) (base+h->distOffset);
+            compute_row_offsets(inst);
+            break;
+        case TSPI_FULL:
+            inst->d = xmalloc(sizeof(int*)*n);
+            inst->d[0] = (int *) (base+h->distOffset);
+            for ( int i=1 ; (i<n) ; ++i )
+                inst->d[i] = inst->d[i-1] + n;
+            break;
+    }
+    return 1;
+}
+
+static size_t align_snap(size_t pos)
+{
+    return (pos+TSPI_SNAP_ALIGN-1) / TSPI_SNAP_ALIGN * TSPI_SNAP_ALIGN;
+}
+
+static void write_at(FILE *f, size_t pos, const void *data, size_t bytes, const char fileName[])
+{
+    if (fseeko(f, (off_t) pos, SEEK_SET) != 0 || fwrite(data, 1, bytes, f) != bytes)
+    {
+        fprintf(stderr, "Error: could not write snapshot %s.\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void tspi_write_snapshot(const TSPInstance *inst, const char fileName[], int withDistances)
+{
+    const int n = inst->size;
+    SnapHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, snapMagic, sizeof(snapMagic));
+    h.size = n;
+    h.type = inst->type;
+    h.nameLen = inst->name ? (int) strlen(inst->name) : 0;
+    h.nameOffset = sizeof(SnapHeader);
+    size_t pos = align_snap(h.nameOffset + h.nameLen);
+    if (inst->coord)
+    {
+        h.coordOffset = pos;
+        pos = align_snap(pos + sizeof(double)*2*n);
+    }
+    if (inst->origId)
+    {
+        h.origIdOffset = pos;
+        pos = align_snap(pos + sizeof(int)*n);
+    }
+    // distances computed on demand are not written
+    const size_t dBytes = dist_bytes(inst->storage, n);
+    if ((withDistances || !inst->coord) && dBytes)
+    {
+        h.storage = inst->storage;
+        h.distOffset = pos;
+        pos += dBytes;
+    }
+    if (!h.coordOffset && !h.distOffset)
+    {
+        fprintf(stderr, "Error: instance has neither coordinates nor distances to write in %s.\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    h.fileSize = pos;
 
-    int **d;
-};
+    FILE *f = fopen(fileName, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Error: could not create file %s.\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    write_at(f, 0, &h, sizeof(h), fileName);
+    write_at(f, h.nameOffset, inst->name, h.nameLen, fileName);
+    if (h.coordOffset)
+        for ( int i=0 ; i<n ; ++i )
+            write_at(f, h.coordOffset + sizeof(double)*2*i, inst->coord[i], sizeof(double)*2, fileName);
+    if (h.origIdOffset)
+        write_at(f, h.origIdOffset, inst->origId, sizeof(int)*n, fileName);
+    if (h.distOffset)
+    {
+        switch (inst->storage)
+        {
+            case TSPI_PACKED16:
+            case TSPI_PACKED32:
+            {
+                const size_t eBytes = inst->d16 ? sizeof(unsigned short) : sizeof(unsigned int);
+                const char *tri = inst->d16 ? (const char *) inst->d16 : (const char *) inst->d32;
+                if (inst->capacity == n)
+                {
+                    write_at(f, h.distOffset, tri, dBytes, fileName);
+                    break;
+                }
+                // the triangle has room for added cities, rows are written one by one
+                size_t start = 0;
+                for ( int i=0 ; i<n ; ++i )
+                {
+                    write_at(f, h.distOffset + eBytes*start, tri + eBytes*(inst->rowOff[i]+i), eBytes*(n-i), fileName);
+                    start += n-i;
+                }
+                break;
+            }
+            case TSPI_FULL:
+                for ( int i=0 ; i<n ; ++i )
+                    write_at(f, h.distOffset + sizeof(int)*((size_t)n)*i, inst->d[i], sizeof(int)*n, fileName);
+                break;
+        }
+    }
+    // padding of the last section
+    if (fseeko(f, (off_t) pos, SEEK_SET) != 0 || ftruncate(fileno(f), (off_t) pos) != 0 || fclose(f) != 0)
+    {
+        fprintf(stderr, "Error: could not write snapshot %s.\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+}
 
-static void compute_distances(TSPInstance *inst, double **coord) 
+TSPInstance *tspi_create_opt(const char fileName[], const TSPIOptions *_opt)
 {
-    int **d = inst->d;
-    for (int i=0 ; i<inst->size; ++i )
+    TSPIOptions opt;
+    if (_opt)
+        opt = *_opt;
+    else
+        tspi_default_options(&opt);
+
+    TSPInstance *inst = xmalloc(sizeof(TSPInstance));
+    memset(inst, 0, sizeof(TSPInstance));
+
+    const int fd = open(fileName, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Error: could not open file %s.\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    const size_t size = st.st_size;
+    void *map = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+    close(fd);
+    if (map == MAP_FAILED || !size)
+    {
+        fprintf(stderr, "Error: could not map file %s.\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (size >= sizeof(snapMagic) && memcmp(map, snapMagic, sizeof(snapMagic)) == 0)
+    {
+        // snapshot stays mapped, shared by processes reading it
+        inst->map = map;
+        inst->mapSize = size;
+        if (load_snapshot(inst, fileName))
+            return inst;
+    }
+    else
     {
-        d[i][i] = 0;
-        for ( int j=0 ; j<inst->size ; ++j )
+        madvise(map, size, MADV_SEQUENTIAL);
+        parse_tsplib(inst, map, size, fileName);
+        munmap(map, size);
+    }
+
+    if (opt.reorder == TSPI_ORDER_HILBERT && inst->coord && !inst->origId)
+        hilbert_order(inst);
+
+    if (inst->type == TSPI_EXPLICIT)
+    {
+        if (opt.compact)
+            pack_matrix(inst);
+        return inst;
+    }
+
+    // the packed triangle is built with 32 bits
+    const double matrixBytes = opt.compact ? ((double)sizeof(int))*packed_size(inst->size) :
+        ((double)sizeof(int))*inst->size*inst->size;
+    if (matrixBytes <= (double)opt.maxMatrixBytes)
+    {
+        if (opt.compact)
+        {
+            alloc_packed(inst);
+            narrow_packed(inst, pack_distances(inst, inst->coord, inst->type));
+        }
+        else
         {
-               double latitude_i = coord[i][0];
-               double latitude_j = coord[j][0];
-               double longitude_i = coord[i][1];
-               double longitude_j = coord[j][1];
-               double q1 = cos(longitude_i - longitude_j);
-               double q2 = cos(latitude_i - latitude_j);
-               double q3 = cos(latitude_i + latitude_j);
-               d[i][j] = (int)( RRR * acos( 0.5 * ( ( 1.0 + q1 ) * q2 - (1.0 - q1) * q3 ) ) + 1.0 );
+            alloc_matrix(inst);
+            compute_distances(inst, inst->coord, inst->type);
         }
     }
+    else
+    {
+        // distances computed on demand
+        inst->storage = TSPI_ON_DEMAND;
+        if (opt.cacheRows > 0)
+            inst->cache = cache_create(opt.cacheRows < inst->size ? opt.cacheRows : inst->size, inst->size);
+    }
+
+    return inst;
 }
 
-TSPInstance *tspi_create(const char fileName[])
+/* incremental updates: cities keep their numbers in origId, the
+ * storage grows with room for some more cities and only the row
+ * and column of the changed city are computed */
+
+/* makes room for cap cities and owns all data, copying what
+ * points into a snapshot mapping before it is changed */
+static void reserve_cities(TSPInstance *inst, int cap)
 {
-    TSPInstance *inst = calloc( sizeof(TSPInstance), 1 );
-#define LINE_SIZE 512
-    char line[LINE_SIZE], *s;
-    FILE *f = fopen(fileName, "r");
-    assert(f);
-    char readingCoord = 0;
+    const int n = inst->size;
+    const int oldCap = inst->capacity;
+    if (cap <= oldCap && !inst->map && inst->origId && inst->nextId)
+        return;
 
-    double **coord = NULL;
-    while ( (s=fgets(line, LINE_SIZE, f)) ) 
+    // copying the matrix for every added city would be quadratic
+    const int newCap = cap > oldCap ? cap + cap/8 + 16 : oldCap;
+    const char copy = newCap != oldCap || inst->map;
+    inst->capacity = newCap;
+
+    int *origId = xmalloc(sizeof(int)*newCap);
+    int maxId = -1;
+    for ( int i=0 ; i<n ; ++i )
+    {
+        origId[i] = tspi_original_id(inst, i);
+        maxId = origId[i] > maxId ? origId[i] : maxId;
+    }
+    free_owned(inst, inst->origId);
+    inst->origId = origId;
+    inst->nextId = inst->nextId > maxId ? inst->nextId : maxId+1;
+
+    if (!copy)
+        return;
+
+    if (inst->coord)
     {
-        if ( readingCoord ) 
+        double **coord = inst->coord;
+        double *data = xmalloc(sizeof(double)*2*newCap);
+        for ( int i=0 ; i<n ; ++i )
         {
-            if (strstr(s, "EOF"))
-                break;
+            data[2*i] = coord[i][0];
+            data[2*i+1] = coord[i][1];
+        }
+        free_owned(inst, coord[0]);
+        free(coord);
+        alloc_coord(inst, data);
+    }
 
-            int i; double x,y;
-            int nr = sscanf(s, "%d %lf %lf", &i, &x, &y);
+    if (inst->d)
+    {
+        int **d = inst->d;
+        alloc_matrix(inst);
+        for ( int i=0 ; i<n ; ++i )
+            memcpy(inst->d[i], d[i], sizeof(int)*n);
+        free_matrix(inst, d[0], TSPI_FULL, oldCap);
+        free(d);
+    }
 
-            assert(nr == 3);
-            coord[i-1][0] = rad(x);
-            coord[i-1][1] = rad(y);
+    if (inst->rowOff)
+    {
+        size_t *rowOff = inst->rowOff;
+        unsigned short *d16 = inst->d16;
+        unsigned int *d32 = inst->d32;
+        compute_row_offsets(inst);
+        const size_t size = packed_size(newCap);
+        if (d16)
+        {
+            inst->d16 = bm_alloc(sizeof(unsigned short)*size);
+            for ( int i=0 ; i<n ; ++i )
+                memcpy(inst->d16+inst->rowOff[i]+i, d16+rowOff[i]+i, sizeof(unsigned short)*(n-i));
         }
         else
         {
-            if (strstr(s, "NAME:")) 
+            inst->d32 = bm_alloc(sizeof(unsigned int)*size);
+            for ( int i=0 ; i<n ; ++i )
+                memcpy(inst->d32+inst->rowOff[i]+i, d32+rowOff[i]+i, sizeof(unsigned int)*(n-i));
+        }
+        free_matrix(inst, d16, TSPI_PACKED16, oldCap);
+        free_matrix(inst, d32, TSPI_PACKED32, oldCap);
+        free(rowOff);
+    }
+
+    if (inst->map)
+    {
+        munmap(inst->map, inst->mapSize);
+        inst->map = NULL;
+        inst->mapSize = 0;
+    }
+}
+
+/* moves the 16 bit triangle to 32 bits, for distances
+ * of updated cities that don't fit */
+static void widen_packed(TSPInstance *inst)
+{
+    const size_t size = packed_size(inst->capacity);
+    inst->d32 = bm_alloc(sizeof(unsigned int)*size);
+    for ( size_t p=0 ; p<size ; ++p )
+        inst->d32[p] = inst->d16[p];
+    bm_free(inst->d16, dist_bytes(TSPI_PACKED16, inst->capacity));
+    inst->d16 = NULL;
+    inst->storage = TSPI_PACKED32;
+}
+
+static void set_dist(TSPInstance *inst, int i, int j, int dist)
+{
+    const int a = i < j ? i : j;
+    const int b = i < j ? j : i;
+    switch (inst->storage)
+    {
+        case TSPI_PACKED16:
+            inst->d16[inst->rowOff[a]+b] = (unsigned short) dist;
+            break;
+        case TSPI_PACKED32:
+            inst->d32[inst->rowOff[a]+b] = (unsigned int) dist;
+            break;
+        case TSPI_FULL:
+            inst->d[i][j] = dist;
+            break;
+    }
+}
+
+/* the row size of the cache changes with the number of cities */
+static void reset_cache(TSPInstance *inst)
+{
+    if (!inst->cache)
+        return;
+    const int capRows = inst->cache->capRows;
+    cache_free(inst->cache);
+    inst->cache = cache_create(capRows < inst->size ? capRows : inst->size, inst->size);
+}
+
+/* candidate lists are built again on the next tspi_neighbors */
+static void drop_neighbors(TSPInstance *inst)
+{
+    if (!inst->nbStart)
+        return;
+    free(inst->nbStart);
+    free(inst->nbList);
+    inst->nbStart = inst->nbList = NULL;
+}
+
+/* computes the distances from and to city i */
+static void update_city(TSPInstance *inst, int i)
+{
+    const int n = inst->size;
+    drop_neighbors(inst);
+    if (inst->storage == TSPI_ON_DEMAND)
+    {
+        // cached rows get the new column, row i is computed again
+        RowCache *cache = inst->cache;
+        for ( int s=0 ; cache && s<cache->nRows ; ++s )
+        {
+            int *row = cache->rows + ((size_t)s)*n;
+            if (cache->rowOf[s] == i)
+                compute_row(inst, i, row);
+            else
+                row[i] = coord_dist(inst, cache->rowOf[s], i);
+        }
+        return;
+    }
+
+    int *row = xmalloc(sizeof(int)*n);
+    compute_row(inst, i, row);
+    if (inst->storage == TSPI_PACKED16)
+    {
+        for ( int j=0 ; j<n ; ++j )
+        {
+            if (row[j] > USHRT_MAX)
             {
-                char *p, *t = NULL;
-                p = strtok_r(s, " ", &t);
-                assert( p != NULL );
-                p = strtok_r(NULL, " ", &t);
-                int l = strlen(p);
-                if (p[l-1]=='\n') 
-                {
-                    p[l-1]='\0';
-                    --l;
-                }
-                inst->name = malloc(l+1);
-                strcpy(inst->name, p);
-                printf("instance name: %s\n", inst->name);
+                widen_packed(inst);
+                break;
             }
-            if (strstr(s, "DIMENSION:")) 
+        }
+    }
+    for ( int j=0 ; j<n ; ++j )
+    {
+        set_dist(inst, i, j, row[j]);
+        set_dist(inst, j, i, row[j]);
+    }
+    free(row);
+}
+
+static void check_coordinates(const TSPInstance *inst)
+{
+    if (!inst->coord)
+    {
+        fprintf(stderr, "Error: cities of instances without coordinates can not be added or moved.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int tspi_add_city(TSPInstance *tspi, double x, double y)
+{
+    const int i = tspi->size;
+    check_coordinates(tspi);
+    reserve_cities(tspi, i+1);
+    tspi->size++;
+    set_coord(tspi, i, x, y);
+    tspi->origId[i] = tspi->nextId++;
+    reset_cache(tspi);
+    update_city(tspi, i);
+    return i;
+}
+
+void tspi_move_city(TSPInstance *tspi, int i, double x, double y)
+{
+    check_coordinates(tspi);
+    if (i < 0 || i >= tspi->size)
+    {
+        fprintf(stderr, "Error: invalid city %d.\n", i);
+        exit(EXIT_FAILURE);
+    }
+    reserve_cities(tspi, tspi->size);
+    set_coord(tspi, i, x, y);
+    update_city(tspi, i);
+}
+
+void tspi_remove_city(TSPInstance *tspi, int i)
+{
+    const int last = tspi->size-1;
+    if (i < 0 || i > last || last == 0)
+    {
+        fprintf(stderr, "Error: city %d can not be removed.\n", i);
+        exit(EXIT_FAILURE);
+    }
+    reserve_cities(tspi, tspi->size);
+    drop_neighbors(tspi);
+
+    // the last city takes number i, its distances are moved
+    if (i != last)
+    {
+        tspi->origId[i] = tspi->origId[last];
+        if (tspi->coord)
+        {
+            tspi->coord[i][0] = tspi->coord[last][0];
+            tspi->coord[i][1] = tspi->coord[last][1];
+        }
+        if (tspi->storage != TSPI_ON_DEMAND)
+        {
+            for ( int j=0 ; j<last ; ++j )
             {
-                char *p, *t = NULL;
-                p = strtok_r(s, " ", &t);
-                assert( p != NULL );
-                p = strtok_r(NULL, " ", &t);
-                assert( p != NULL );
-                inst->size = atoi(p);
-                printf("instance size: %d\n", inst->size);
-
-                coord = malloc(sizeof(double*)*inst->size);
-                coord[0] = malloc(sizeof(double)*inst->size*2);
-                for ( int i=1 ; (i<inst->size) ; ++i )
-                    coord[i] = coord[i-1]+2;
-
-                inst->d = malloc(sizeof(int*)*inst->size);
-                assert(inst->d);
-                inst->d[0] = malloc(sizeof(int)*inst->size*inst->size);
-                for ( int i=1 ; (i<inst->size) ; ++i )
-                    inst->d[i] = inst->d[i-1] + inst->size;
+                if (j == i)
+                    continue;
+                set_dist(tspi, i, j, tspi_dist(tspi, last, j));
+                set_dist(tspi, j, i, tspi_dist(tspi, j, last));
             }
-            if (strstr(s, "NODE_COORD_SECTION"))
+            set_dist(tspi, i, i, tspi_dist(tspi, last, last));
+        }
+    }
+    tspi->size--;
+    reset_cache(tspi);
+}
+
+/* k-d tree over the coordinates (3D unit vectors for GEO, where
+ * the chord grows with the great circle distance), implicit in the
+ * order of points: each range has its split point in the middle */
+typedef struct
+{
+    int n;
+    int dim;
+    double *pt;   // dim coordinates per city
+    double **coord;   // coordinates of the instance, for quadrants
+    int *idx;     // cities in tree order
+    char *split;  // split dimension, at the middle position of each range
+} KDTree;
+
+/* nearest points found by a search, max heap by distance */
+typedef struct
+{
+    int k;
+    int size;
+    double *dist2;
+    int *id;
+} KDBest;
+
+static void kd_partition(KDTree *kd, int lo, int hi, int m, int d)
+{
+    const double *pt = kd->pt;
+    const int dim = kd->dim;
+    int *idx = kd->idx;
+    while (hi-lo > 1)
+    {
+        const double pivot = pt[idx[(lo+hi)/2]*dim+d];
+        int i = lo, j = hi-1;
+        while (i <= j)
+        {
+            while (pt[idx[i]*dim+d] < pivot)
+                ++i;
+            while (pt[idx[j]*dim+d] > pivot)
+                --j;
+            if (i <= j)
             {
-                readingCoord = 1;
+                const int t = idx[i];
+                idx[i++] = idx[j];
+                idx[j--] = t;
             }
         }
+        if (m <= j)
+            hi = j+1;
+        else if (m >= i)
+            lo = i;
+        else
+            return;
     }
+}
 
-    compute_distances(inst, coord);
+static void kd_build(KDTree *kd, int lo, int hi)
+{
+    if (hi-lo <= KD_LEAF)
+        return;
 
-    /*
-    printf("distance matrix:\n");
-    for ( int i=0 ; (i<inst->size) ; ++i )
+    // splits the dimension with the largest spread
+    const int dim = kd->dim;
+    double minC[3], maxC[3];
+    for ( int d=0 ; d<dim ; ++d )
+        minC[d] = maxC[d] = kd->pt[kd->idx[lo]*dim+d];
+    for ( int i=lo+1 ; i<hi ; ++i )
     {
-        for ( int j=0 ; (j<inst->size) ; ++j )
+        for ( int d=0 ; d<dim ; ++d )
         {
-            printf("%d ", inst->d[i][j]);
+            const double c = kd->pt[kd->idx[i]*dim+d];
+            minC[d] = c < minC[d] ? c : minC[d];
+            maxC[d] = c > maxC[d] ? c : maxC[d];
         }
-        printf("\n");
-    } */
-    
-    if (coord)
+    }
+    int sd = 0;
+    for ( int d=1 ; d<dim ; ++d )
+        if (maxC[d]-minC[d] > maxC[sd]-minC[sd])
+            sd = d;
+
+    const int m = (lo+hi)/2;
+    kd_partition(kd, lo, hi, m, sd);
+    kd->split[m] = sd;
+    kd_build(kd, lo, m);
+    kd_build(kd, m+1, hi);
+}
+
+static KDTree *kd_create(const TSPInstance *inst)
+{
+    const int n = inst->size;
+    KDTree *kd = xmalloc(sizeof(KDTree));
+    kd->n = n;
+    kd->dim = inst->type == TSPI_GEO ? 3 : 2;
+    kd->coord = inst->coord;
+    kd->pt = xmalloc(sizeof(double)*kd->dim*n);
+    kd->idx = xmalloc(sizeof(int)*n);
+    kd->split = xmalloc(sizeof(char)*n);
+    for ( int i=0 ; i<n ; ++i )
     {
-        free(coord[0]);
-        free(coord);
+        const double *c = inst->coord[i];
+        if (kd->dim == 3)
+        {
+            kd->pt[i*3] = cos(c[0])*cos(c[1]);
+            kd->pt[i*3+1] = cos(c[0])*sin(c[1]);
+            kd->pt[i*3+2] = sin(c[0]);
+        }
+        else
+        {
+            kd->pt[i*2] = c[0];
+            kd->pt[i*2+1] = c[1];
+        }
+        kd->idx[i] = i;
     }
+    kd_build(kd, 0, n);
+    return kd;
+}
 
-    fclose(f);
-    return inst;
-#undef LINE_SIZE
+static void kd_free(KDTree *kd)
+{
+    free(kd->pt);
+    free(kd->idx);
+    free(kd->split);
+    free(kd);
+}
+
+static void best_add(KDBest *best, double dist2, int id)
+{
+    int pos;
+    if (best->size < best->k)
+        pos = best->size++;
+    else
+    {
+        if (dist2 >= best->dist2[0])
+            return;
+        // removes the farthest, sifting down the last
+        pos = 0;
+        const double ld = best->dist2[--best->size];
+        const int lid = best->id[best->size];
+        while (1)
+        {
+            int c = 2*pos+1;
+            if (c >= best->size)
+                break;
+            if (c+1 < best->size && best->dist2[c+1] > best->dist2[c])
+                ++c;
+            if (best->dist2[c] <= ld)
+                break;
+            best->dist2[pos] = best->dist2[c];
+            best->id[pos] = best->id[c];
+            pos = c;
+        }
+        best->dist2[pos] = ld;
+        best->id[pos] = lid;
+        pos = best->size++;
+    }
+    while (pos > 0 && best->dist2[(pos-1)/2] < dist2)
+    {
+        best->dist2[pos] = best->dist2[(pos-1)/2];
+        best->id[pos] = best->id[(pos-1)/2];
+        pos = (pos-1)/2;
+    }
+    best->dist2[pos] = dist2;
+    best->id[pos] = id;
+}
+
+/* quadrant of point p around q in the instance coordinates
+ * (latitude and longitude for GEO), -1 searches all points */
+static int quadrant(const double *q, const double *p)
+{
+    return (p[0] >= q[0]) + 2*(p[1] >= q[1]);
+}
+
+/* only in the plane the tree coordinates are the instance ones */
+static char box_in_quadrant(const KDTree *kd, const double *q, const double *boxLo, const double *boxHi, int quad)
+{
+    if (quad < 0 || kd->dim != 2)
+        return 1;
+    if ( (quad & 1) ? boxHi[0] < q[0] : boxLo[0] >= q[0] )
+        return 0;
+    if ( (quad & 2) ? boxHi[1] < q[1] : boxLo[1] >= q[1] )
+        return 0;
+    return 1;
+}
+
+static void kd_search(const KDTree *kd, int lo, int hi, double *boxLo, double *boxHi,
+                      int city, int quad, KDBest *best)
+{
+    const int dim = kd->dim;
+    const double *q = kd->pt + city*dim;
+
+    // squared distance to the box
+    double boxD = 0.0;
+    for ( int d=0 ; d<dim ; ++d )
+    {
+        const double diff = q[d] < boxLo[d] ? boxLo[d]-q[d] : (q[d] > boxHi[d] ? q[d]-boxHi[d] : 0.0);
+        boxD += diff*diff;
+    }
+    if (best->size == best->k && boxD >= best->dist2[0])
+        return;
+    if (!box_in_quadrant(kd, q, boxLo, boxHi, quad))
+        return;
+
+    if (hi-lo <= KD_LEAF)
+    {
+        for ( int i=lo ; i<hi ; ++i )
+        {
+            const int c = kd->idx[i];
+            const double *p = kd->pt + c*dim;
+            if (c == city || (quad >= 0 && quadrant(kd->coord[city], kd->coord[c]) != quad))
+                continue;
+            double d2 = 0.0;
+            for ( int d=0 ; d<dim ; ++d )
+                d2 += (p[d]-q[d])*(p[d]-q[d]);
+            best_add(best, d2, c);
+        }
+        return;
+    }
+
+    const int m = (lo+hi)/2;
+    const int sd = kd->split[m];
+    const int c = kd->idx[m];
+    const double *p = kd->pt + c*dim;
+    if (c != city && (quad < 0 || quadrant(kd->coord[city], kd->coord[c]) == quad))
+    {
+        double d2 = 0.0;
+        for ( int d=0 ; d<dim ; ++d )
+            d2 += (p[d]-q[d])*(p[d]-q[d]);
+        best_add(best, d2, c);
+    }
+
+    // nearest side first
+    const double v = p[sd];
+    const double oldLo = boxLo[sd], oldHi = boxHi[sd];
+    for ( int side=0 ; side<2 ; ++side )
+    {
+        const char left = (q[sd] < v) ^ side;
+        if (left)
+        {
+            boxHi[sd] = v;
+            kd_search(kd, lo, m, boxLo, boxHi, city, quad, best);
+            boxHi[sd] = oldHi;
+        }
+        else
+        {
+            boxLo[sd] = v;
+            kd_search(kd, m+1, hi, boxLo, boxHi, city, quad, best);
+            boxLo[sd] = oldLo;
+        }
+    }
+}
+
+/* distance without the row cache, safe in parallel */
+static int pair_dist(const TSPInstance *inst, int i, int j)
+{
+    return inst->storage == TSPI_ON_DEMAND ? coord_dist(inst, i, j) : tspi_dist(inst, i, j);
+}
+
+typedef struct
+{
+    int dist;
+    int id;
+} DistId;
+
+static int cmp_dist_id(const void *p1, const void *p2)
+{
+    const DistId *a = p1, *b = p2;
+    if (a->dist != b->dist)
+        return a->dist < b->dist ? -1 : 1;
+    return a->id - b->id;
+}
+
+/* sorts candidates by distance to city and removes repeated ones */
+static int sort_neighbors(const TSPInstance *inst, int city, int *cand, int nCand, DistId *buf)
+{
+    for ( int i=0 ; i<nCand ; ++i )
+    {
+        buf[i].dist = pair_dist(inst, city, cand[i]);
+        buf[i].id = cand[i];
+    }
+    qsort(buf, nCand, sizeof(DistId), cmp_dist_id);
+    int n = 0;
+    for ( int i=0 ; i<nCand ; ++i )
+        if (n == 0 || cand[n-1] != buf[i].id)
+            cand[n++] = buf[i].id;
+    return n;
+}
+
+void tspi_build_neighbors(TSPInstance *inst, int k, int kq)
+{
+    const int n = inst->size;
+    k = k < n-1 ? k : n-1;
+    k = k > 0 ? k : 0;
+    kq = inst->coord ? (kq < n-1 ? kq : n-1) : 0;
+    kq = kq > 0 ? kq : 0;
+    const int maxCand = k+4*kq;
+
+    if (inst->nbStart)
+    {
+        free(inst->nbStart);
+        free(inst->nbList);
+    }
+    inst->nbK = k;
+    inst->nbKq = kq;
+    inst->nbStart = xmalloc(sizeof(int)*(n+1));
+    int *cand = xmalloc(sizeof(int)*((size_t)n)*(maxCand ? maxCand : 1));
+    int *nCand = xmalloc(sizeof(int)*n);
+
+    KDTree *kd = inst->coord ? kd_create(inst) : NULL;
+
+#pragma omp parallel if(n>=TSPI_PAR_MIN_SIZE)
+    {
+        const int maxK = (k > kq ? k : kq) + 1;
+        KDBest best;
+        best.dist2 = xmalloc(sizeof(double)*maxK);
+        best.id = xmalloc(sizeof(int)*maxK);
+        DistId *buf = xmalloc(sizeof(DistId)*(maxCand+1));
+
+#pragma omp for schedule(dynamic,64)
+        for ( int i=0 ; i<n ; ++i )
+        {
+            int *ci = cand + ((size_t)i)*maxCand;
+            int nc = 0;
+            if (kd)
+            {
+                for ( int quad=-1 ; quad<4 ; ++quad )
+                {
+                    best.k = quad < 0 ? k : kq;
+                    best.size = 0;
+                    if (!best.k)
+                        continue;
+                    double boxLo[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+                    double boxHi[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL };
+                    kd_search(kd, 0, n, boxLo, boxHi, i, quad, &best);
+                    memcpy(ci+nc, best.id, sizeof(int)*best.size);
+                    nc += best.size;
+                }
+            }
+            else
+            {
+                // no coordinates, scans the row keeping the k nearest
+                best.k = k;
+                best.size = 0;
+                for ( int j=0 ; j<n && k ; ++j )
+                    if (j != i)
+                        best_add(&best, (double) pair_dist(inst, i, j), j);
+                memcpy(ci, best.id, sizeof(int)*best.size);
+                nc = best.size;
+            }
+            nCand[i] = sort_neighbors(inst, i, ci, nc, buf);
+        }
+
+        free(best.dist2);
+        free(best.id);
+        free(buf);
+    }
+
+    inst->nbStart[0] = 0;
+    for ( int i=0 ; i<n ; ++i )
+        inst->nbStart[i+1] = inst->nbStart[i] + nCand[i];
+    inst->nbList = xmalloc(sizeof(int)*(inst->nbStart[n] ? inst->nbStart[n] : 1));
+    for ( int i=0 ; i<n ; ++i )
+        memcpy(inst->nbList+inst->nbStart[i], cand+((size_t)i)*maxCand, sizeof(int)*nCand[i]);
+
+    if (kd)
+        kd_free(kd);
+    free(cand);
+    free(nCand);
+}
+
+const int *tspi_neighbors(TSPInstance *inst, int i, int k, int *nNeighbors)
+{
+    const int n = inst->size;
+    const int builtK = k < n-1 ? (k > 0 ? k : 0) : n-1;
+    if (!inst->nbStart || inst->nbK != builtK)
+        tspi_build_neighbors(inst, k, inst->nbStart ? inst->nbKq : TSPI_QUADRANT_NEIGHBORS);
+
+    *nNeighbors = inst->nbStart[i+1] - inst->nbStart[i];
+    return inst->nbList + inst->nbStart[i];
+}
+
+int tspi_original_id(const TSPInstance *tspi, int i)
+{
+    return tspi->origId ? tspi->origId[i] : i;
 }
 
 int tspi_size(const TSPInstance *tspi)
@@ -145,16 +1839,78 @@ int tspi_size(const TSPInstance *tspi)
 
 int tspi_dist(const TSPInstance *tspi, int i, int j)
 {
-    return tspi->d[i][j];
+    // position in the triangle, min and max without branches
+    const int a = j ^ ((i ^ j) & -(i < j));
+    const int b = i ^ j ^ a;
+    switch (tspi->storage)
+    {
+        case TSPI_PACKED16:
+            return tspi->d16[tspi->rowOff[a]+b];
+        case TSPI_PACKED32:
+            return (int) tspi->d32[tspi->rowOff[a]+b];
+        case TSPI_FULL:
+            return tspi->d[i][j];
+    }
+
+    RowCache *cache = tspi->cache;
+    if (cache)
+    {
+        if (cache->slotOf[i] >= 0)
+            return cache_row(tspi, i)[j];
+
+        // symmetric, row j may be cached
+        if (cache->slotOf[j] >= 0)
+            return cache_row(tspi, j)[i];
+
+        // on a column scan row j is computed
+        const char column = (j == cache->lastJ && i != cache->lastI);
+        cache->lastI = i;
+        cache->lastJ = j;
+        return column ? cache_row(tspi, j)[i] : cache_row(tspi, i)[j];
+    }
+
+    return coord_dist(tspi, i, j);
 }
 
 void tspi_free(TSPInstance *tspi)
 {
     if (tspi->name)
         free(tspi->name);
-    free(tspi->d[0]);
-    free(tspi->d);
+    if (tspi->d)
+    {
+        free_matrix(tspi, tspi->d[0], TSPI_FULL, tspi->capacity);
+        free(tspi->d);
+    }
+    free_matrix(tspi, tspi->d16, TSPI_PACKED16, tspi->capacity);
+    free_owned(tspi, tspi->origId);
+    free_matrix(tspi, tspi->d32, TSPI_PACKED32, tspi->capacity);
+    if (tspi->rowOff)
+        free(tspi->rowOff);
+    if (tspi->coord)
+    {
+        free_owned(tspi, tspi->coord[0]);
+        free(tspi->coord);
+    }
+    if (tspi->cache)
+        cache_free(tspi->cache);
+    if (tspi->nbStart)
+    {
+        free(tspi->nbStart);
+        free(tspi->nbList);
+    }
+    if (tspi->map)
+        munmap(tspi->map, tspi->mapSize);
     free(tspi);
 }
 
+static void *xmalloc( const size_t size )
+{
+    void *result = malloc( size );
+    if (!result)
+    {
+        fprintf(stderr, "No more memory available. Trying to allocate %zu bytes.", size);
+        abort();
+    }
 
+    return result;
+}
@@ -1,14 +1,89 @@
 #ifndef TSP_INSTANCE_H
 #define TSP_INSTANCE_H
 
+#include <stddef.h>
+
+// city orders
+#define TSPI_ORDER_FILE    0   // as in the file
+#define TSPI_ORDER_HILBERT 1   // along a Hilbert curve
+
 typedef struct _TSPInstance TSPInstance;
 
+typedef struct
+{
+    // larger distance matrices are not stored, distances are
+    // computed from the coordinates by tspi_dist
+    size_t maxMatrixBytes;
+
+    // rows kept in a LRU cache when not storing the matrix,
+    // 0 computes each distance
+    int cacheRows;
+
+    // symmetric instances store the upper triangle with 16 bit
+    // distances if the largest fits, otherwise with 32 bits
+    char compact;
+
+    // with TSPI_ORDER_HILBERT cities with coordinates are
+    // renumbered so that nearby cities have close numbers, see
+    // tspi_original_id. Snapshots with distances keep their order.
+    int reorder;
+} TSPIOptions;
+
+/* reads a TSPLIB file with EDGE_WEIGHT_TYPE GEO, EUC_2D, CEIL_2D, ATT
+ * or EXPLICIT (FULL_MATRIX, UPPER_ROW, LOWER_ROW, UPPER_DIAG_ROW,
+ * LOWER_DIAG_ROW), or a snapshot written by tspi_write_snapshot,
+ * recognized by its magic number */
 TSPInstance *tspi_create(const char fileName[]);
 
+/* opt may be NULL for the default options */
+TSPInstance *tspi_create_opt(const char fileName[], const TSPIOptions *opt);
+
+void tspi_default_options(TSPIOptions *opt);
+
 int tspi_size(const TSPInstance *tspi);
 
+/* number of city i in the instance file, before any renumbering.
+ * Added cities get numbers after the largest one, so numbers
+ * identify cities across updates. */
+int tspi_original_id(const TSPInstance *tspi, int i);
+
+/* with a row cache, not safe for concurrent calls */
 int tspi_dist(const TSPInstance *tspi, int i, int j);
 
+/* builds the candidate lists of all cities with a k-d tree: the k
+ * nearest cities plus, in each quadrant around the city, the kq
+ * nearest ones. Instances without coordinates (EXPLICIT) have only
+ * the k nearest. */
+void tspi_build_neighbors(TSPInstance *tspi, int k, int kq);
+
+/* candidate list of city i sorted by distance, lists are built on
+ * the first call or when k changes, with the kq of the previous
+ * build or TSPI_QUADRANT_NEIGHBORS. Returns the list and its size
+ * in nNeighbors. */
+const int *tspi_neighbors(TSPInstance *tspi, int i, int k, int *nNeighbors);
+
+/* writes a binary snapshot with the coordinates and, if withDistances
+ * (always for EXPLICIT instances), the stored distances. Snapshots are
+ * mapped read-only when loaded and the distances are used in place, so
+ * processes loading the same snapshot share its memory. Distances
+ * computed on demand are not written. */
+void tspi_write_snapshot(const TSPInstance *tspi, const char fileName[], int withDistances);
+
+/* incremental updates, computing only the distances of the changed
+ * city. Snapshot data is copied before the first update, candidate
+ * lists are built again and the row cache is cleared when cities
+ * are added or removed. Cities can be added and moved only in
+ * instances with coordinates, given in the units of the file
+ * (degrees for GEO). */
+
+/* adds a city at (x, y), returns its index, the last one */
+int tspi_add_city(TSPInstance *tspi, double x, double y);
+
+void tspi_move_city(TSPInstance *tspi, int i, double x, double y);
+
+/* removes city i, the last city takes its index */
+void tspi_remove_city(TSPInstance *tspi, int i);
+
 void tspi_free(TSPInstance *tspi);
 
 #endif
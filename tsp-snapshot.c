@@ -0,0 +1,41 @@
+/********************************************************************************
+ * tsp-snapshot
+ *
+ * Converts a TSPLIB instance to a binary snapshot, which tspi_create maps
+ * read-only instead of parsing the file and computing the distances again.
+ *
+ * This program and the accompanying materials are made available under the
+ * terms of the Eclipse Public License 2.0 which is available at
+ * http://www.eclipse.org/legal/epl-2.0
+ *
+ ********************************************************************************/
+
+/**
+ * @file tsp-snapshot.c
+ *
+ * Usage: tsp-snapshot instance.tsp snapshot [-c]
+ *
+ * With -c only the coordinates are written and distances are computed when
+ * the snapshot is loaded (EXPLICIT instances always include distances).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tsp-instance.h"
+
+int main( int argc, char **argv )
+{
+    if ( argc<3 || (argc>3 && strcmp( argv[3], "-c" )!=0) )
+    {
+        fprintf( stderr, "usage: tsp-snapshot instance.tsp snapshot [-c]\n" );
+        exit( EXIT_FAILURE );
+    }
+
+    TSPInstance *inst = tspi_create( argv[1] );
+    tspi_write_snapshot( inst, argv[2], argc<=3 );
+    printf( "snapshot of %d cities written to %s\n", tspi_size( inst ), argv[2] );
+    tspi_free( inst );
+
+    return EXIT_SUCCESS;
+}